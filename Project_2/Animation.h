@@ -0,0 +1,116 @@
+#ifndef _ANIMATION_H_
+#define _ANIMATION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneDiff.h"
+#include "Tiles.h"
+
+/**
+ * The moving part of an animated scene. Frame f places every sphere at its
+ * base position plus f times its velocity; the base positions are kept so
+ * frames never accumulate rounding.
+ */
+typedef struct {
+  int numMoving;
+  // indices of the spheres with a non-zero velocity
+  int *moving;
+  // their frame 0 centers, three floats each
+  float *base;
+  // times a moved sphere changed tiles and the candidate lists were redone
+  long listRebuilds;
+} Animation;
+
+/**
+ * Collects the spheres that move
+ *
+ * @param anim the animation, freed with freeAnimation()
+ * @param scene the scene at frame 0
+ */
+void initAnimation(Animation *anim, Scene *scene) {
+  memset(anim, 0, sizeof(Animation));
+  if (!scene->sphereVelocities)
+    return;
+
+  anim->moving = malloc(sizeof(int) * scene->numSpheres);
+  anim->base = malloc(sizeof(float) * 3 * scene->numSpheres);
+  for (size_t i = 0; i < scene->numSpheres; i++) {
+    float *v = &scene->sphereVelocities[3 * i];
+    if (v[0] == 0 && v[1] == 0 && v[2] == 0)
+      continue;
+    memcpy(&anim->base[3 * anim->numMoving], scene->spheres[i].center,
+           sizeof(float) * 3);
+    anim->moving[anim->numMoving++] = i;
+  }
+}
+
+void freeAnimation(Animation *anim) {
+  free(anim->moving);
+  free(anim->base);
+}
+
+/**
+ * Moves the scene to the given frame and refits the tile grid instead of
+ * rebuilding it: only moving spheres are projected again, and the candidate
+ * lists are laid out anew only if one of them crossed into other tiles.
+ * The tiles a sphere left or entered are flagged dirty, so the next
+ * renderFrame() re-traces just those and keeps the static background. The
+ * light and world grids are refit the same way, see refitSceneGrids().
+ *
+ * @param ctx the context rendering the animated scene
+ * @param anim
+ * @param frame the frame number to move to
+ */
+void advanceAnimation(RenderContext *ctx, Animation *anim, int frame) {
+  Scene *scene = ctx->scene;
+  TileGrid *grid = &ctx->grid;
+  bool listsChanged = false;
+
+  for (int k = 0; k < anim->numMoving; k++) {
+    int i = anim->moving[k];
+    SphereGeom *sphere = &scene->spheres[i];
+    float *v = &scene->sphereVelocities[3 * i];
+    for (int a = 0; a < 3; a++)
+      sphere->center[a] = anim->base[3 * k + a] + frame * v[a];
+
+    if (!ctx->gridValid)
+      continue;
+
+    int16_t *rect = &grid->rects[4 * i];
+    int16_t moved[4];
+    if (!sphereTileRect(&ctx->view, sphere, moved))
+      moved[0] = -1;
+
+    // the pixels it covered and the pixels it covers now
+    if (rect[0] >= 0)
+      markTiles(ctx, rect);
+    if (moved[0] >= 0)
+      markTiles(ctx, moved);
+
+    bool same = rect[0] < 0 ? moved[0] < 0
+                            : memcmp(rect, moved, sizeof(moved)) == 0;
+    if (!same) {
+      memcpy(rect, moved, sizeof(moved));
+      listsChanged = true;
+    }
+  }
+
+  if (listsChanged) {
+    fillTileLists(grid, scene->numSpheres);
+    anim->listRebuilds++;
+  }
+
+  // moving shadows and reflections can fall anywhere
+  if (anim->numMoving) {
+    refitSceneGrids(ctx, anim->moving, anim->numMoving);
+    if (scene->numLights || scene->reflective)
+      ctx->frameValid = false;
+  }
+}
+
+#endif
@@ -0,0 +1,452 @@
+/**
+ * Benchmark harness for the raycaster.
+ *
+ * Loads each scene given on the command line, renders it at every requested
+ * resolution and prints one JSON record per (scene, resolution) pair with the
+ * load time, render time, primary ray throughput and peak resident set size.
+ * Every scene is benchmarked in its own child process so that the reported
+ * peak RSS belongs to that scene alone. With --verify it instead checks the
+ * camera-specialized primary ray kernels against the general ones.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Clock.h"
+#include "PixTool.h"
+#include "JSONParser.h"
+#include "RayTracer.h"
+#include "Renderer.h"
+#include "VectorMath.h"
+
+static const char cli_help_text[] =
+    "raybench [-r WIDTHxHEIGHT]... [-n repeats] [-a aa samples] [-b bounces]\n"
+    "         [-w] [--verify] [-o output json] [scene file]...\n"
+    "raybench --compare [reference ppm] [test ppm]\n"
+    "Description -- Renders each scene at each resolution and reports JSON,\n"
+    "compares the primary ray kernels with the general ones (--verify),\n"
+    "or compares two renders (e.g. float against double precision)\n";
+
+// a pixel counts as different when any channel is off by more than this
+static const int COMPARE_TOLERANCE = 8;
+// and the images match when fewer than this fraction of pixels differ
+static const double COMPARE_MAX_FRACTION = 0.01;
+
+// --verify limits: the largest relative difference between the distances
+// found by the primary ray kernels and the general ones, the fraction of
+// tests allowed to disagree on hit or miss (rays grazing a sphere) and the
+// fraction of rays allowed a different closest object (near ties). Floats
+// round differently in the two formulas often enough to need looser ones.
+#ifdef RAYCAST_FLOAT
+static const double VERIFY_MAX_T_DIFF = 1e-2;
+static const double VERIFY_MAX_MISMATCHES = 1e-4;
+static const double VERIFY_MAX_CLOSEST_MISMATCHES = 1e-2;
+#else
+static const double VERIFY_MAX_T_DIFF = 1e-6;
+static const double VERIFY_MAX_MISMATCHES = 1e-6;
+static const double VERIFY_MAX_CLOSEST_MISMATCHES = 1e-4;
+#endif
+
+#define MAX_RESOLUTIONS 16
+
+typedef struct {
+  int width;
+  int height;
+} Resolution;
+
+/**
+ * Quotes a string for a JSON record, escaping what JSON does not allow
+ * verbatim
+ *
+ * @return the quoted string, to be freed by the caller
+ */
+static char *jsonString(const char *s) {
+  char *quoted = malloc(6 * strlen(s) + 3);
+  char *q = quoted;
+  *q++ = '"';
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      *q++ = '\\';
+      *q++ = c;
+    } else if (c < 0x20) {
+      q += sprintf(q, "\\u%04x", c);
+    } else {
+      *q++ = c;
+    }
+  }
+  *q++ = '"';
+  *q = '\0';
+  return quoted;
+}
+
+/**
+ * Peak resident set size of this process in kilobytes
+ */
+static long peakRssKb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * Loads and renders one scene at every resolution, printing a JSON record for
+ * each. Runs inside the child process.
+ *
+ * @return 0 on success
+ */
+static int benchScene(char *path, Resolution *resolutions, int numResolutions,
+                      int repeats, RenderOptions *options) {
+  double start = nowMs();
+  Scene *scene = readScene(path);
+  double loadMs = nowMs() - start;
+  if (!scene)
+    return 1;
+
+  long numObjects = scene->numSpheres + scene->numPlanes;
+  char *name = jsonString(path);
+
+  for (int r = 0; r < numResolutions; r++) {
+    int width = resolutions[r].width;
+    int height = resolutions[r].height;
+
+    // keep the best of the repeats, it is the least disturbed by the system;
+    // each repeat starts cold so the tile binning is part of the time
+    double best = INFINITY;
+    RenderStats stats;
+    for (int i = 0; i < repeats; i++) {
+      RenderContext ctx;
+      initRenderContext(&ctx, scene);
+      start = nowMs();
+      setRenderView(&ctx, scene->cameraWidth, scene->cameraHeight, width,
+                    height);
+      renderFrame(&ctx, options, &stats);
+      double elapsed = nowMs() - start;
+      freeRenderContext(&ctx);
+      if (elapsed < best)
+        best = elapsed;
+    }
+
+    printf("%s  {\"scene\": %s, \"precision\": \"" REAL_NAME "\", "
+           "\"objects\": %ld, \"scene_bytes\": %zu, \"width\": %d, "
+           "\"height\": %d, \"load_ms\": %.3f, \"render_ms\": %.3f, "
+           "\"mrays_per_s\": %.4g, \"aa_samples\": %d, "
+           "\"refined_pixels\": %ld, \"total_rays\": %ld, "
+           "\"tests_per_ray\": %.2f, \"lights\": %zu, "
+           "\"trace_ms\": %.3f, \"shade_ms\": %.3f, \"shadow_rays\": %ld, "
+           "\"shadow_tests_per_ray\": %.2f, "
+           "\"occluder_cache_hits\": %ld, \"wavefront\": %s, "
+           "\"secondary_rays\": %ld, \"peak_rss_kb\": %ld}",
+           r == 0 ? "" : ",\n", name, numObjects, sceneBytes(scene), width,
+           height, loadMs,
+           best, (stats.primaryRays + stats.aaRays) / best / 1e3,
+           options->aaSamples, stats.refinedPixels,
+           stats.primaryRays + stats.aaRays,
+           (double)stats.intersectionTests /
+               (stats.primaryRays + stats.aaRays + stats.secondaryRays),
+           scene->numLights,
+           stats.traceMs, stats.shadeMs, stats.shadow.rays,
+           stats.shadow.rays ? (double)stats.shadow.tests / stats.shadow.rays : 0,
+           stats.shadow.cacheHits,
+           options->wavefront || scene->reflective ? "true" : "false",
+           stats.secondaryRays, peakRssKb());
+  }
+  free(name);
+  fflush(stdout);
+  return 0;
+}
+
+/**
+ * Traces the ray through the center of every pixel, and one jittered ray
+ * per pixel, against each candidate of its tile and every plane with both
+ * the primary ray kernels of PrimaryRays.h and the general kernels of
+ * Intersect.h, and prints a JSON record of how far they disagree for each
+ * resolution. Runs inside the child process.
+ *
+ * @return 0 if the kernels agree within tolerance at every resolution, 2
+ * if they do not, 1 if the scene could not be loaded
+ */
+static int verifyScene(char *path, Resolution *resolutions,
+                       int numResolutions) {
+  Scene *scene = readScene(path);
+  if (!scene)
+    return 1;
+
+  char *name = jsonString(path);
+  int failed = 0;
+  for (int r = 0; r < numResolutions; r++) {
+    int width = resolutions[r].width;
+    int height = resolutions[r].height;
+
+    // a render builds the tile grid and compiles the scene
+    RenderContext ctx;
+    initRenderContext(&ctx, scene);
+    setRenderView(&ctx, scene->cameraWidth, scene->cameraHeight, width, height);
+    renderFrame(&ctx, NULL, NULL);
+    TileGrid *grid = &ctx.grid;
+
+    long rays = 0, tests = 0, mismatches = 0, closestMismatches = 0;
+    double maxDiff = 0;
+    real Ro[3] = {0, 0, 0};
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        int tile = (y / TILE_SIZE) * grid->tilesX + x / TILE_SIZE;
+        int *candidates = &grid->indices[grid->offsets[tile]];
+        int count = grid->offsets[tile + 1] - grid->offsets[tile];
+
+        for (int s = 0; s < 2; s++) {
+          real Rd[3];
+          if (s == 0)
+            primaryRay(&ctx.view, x + 0.5, y + 0.5, Rd);
+          else
+            primaryRay(&ctx.view, x + sampleJitter(x, y, 0),
+                       y + sampleJitter(x, y, 1), Rd);
+          rays++;
+
+          for (int k = 0; k < count + (int)scene->numPlanes; k++) {
+            real general, primary;
+            if (k < count) {
+              int i = candidates[k];
+              general = sphereIntersection(Ro, Rd, &scene->spheres[i]);
+              primary = primarySphereIntersection(Rd, &ctx.compiled.spheres[i]);
+            } else {
+              int j = k - count;
+              general = planeIntersection(Ro, Rd, &scene->planes[j]);
+              primary = primaryPlaneIntersection(Rd, &ctx.compiled.planes[j]);
+            }
+            tests++;
+            if ((general > 0) != (primary > 0)) {
+              mismatches++;
+            } else if (general > 0 && isfinite(general)) {
+              double diff = fabs(primary - general) / general;
+              if (diff > maxDiff)
+                maxDiff = diff;
+            }
+          }
+
+          real tGeneral, tPrimary;
+          int hitGeneral =
+              closestCandidate(scene, candidates, count, Ro, Rd, &tGeneral);
+          int hitPrimary =
+              closestPrimary(&ctx.compiled, candidates, count, Rd, &tPrimary);
+          closestMismatches += hitGeneral != hitPrimary;
+        }
+      }
+    }
+    freeRenderContext(&ctx);
+
+    bool ok = maxDiff <= VERIFY_MAX_T_DIFF &&
+              mismatches <= VERIFY_MAX_MISMATCHES * tests &&
+              closestMismatches <= VERIFY_MAX_CLOSEST_MISMATCHES * rays;
+    failed |= !ok;
+    printf("%s  {\"scene\": %s, \"precision\": \"" REAL_NAME "\", "
+           "\"width\": %d, \"height\": %d, \"rays\": %ld, \"tests\": %ld, "
+           "\"max_t_rel_diff\": %.3g, \"hit_mismatches\": %ld, "
+           "\"closest_hit_mismatches\": %ld, \"within_tolerance\": %s}",
+           r == 0 ? "" : ",\n", name, width, height, rays, tests, maxDiff,
+           mismatches, closestMismatches, ok ? "true" : "false");
+  }
+  free(name);
+  fflush(stdout);
+  return failed ? 2 : 0;
+}
+
+static Pixel *loadPPM(char *path, size_t *width, size_t *height) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Error: Failed to open file %s\n", path);
+    exit(1);
+  }
+  Pixel *buffer = binaryToBuffer(file, width, height);
+  fclose(file);
+  if (!buffer) {
+    fprintf(stderr, "Error: %s is not a binary 8-bit PPM\n", path);
+    exit(1);
+  }
+  return buffer;
+}
+
+/**
+ * Compares two renders of the same scene and prints the per-channel error as
+ * JSON
+ *
+ * @return 0 if the images are within tolerance of each other
+ */
+static int compareImages(char *referencePath, char *testPath) {
+  size_t w1, h1, w2, h2;
+  Pixel *reference = loadPPM(referencePath, &w1, &h1);
+  Pixel *test = loadPPM(testPath, &w2, &h2);
+  if (w1 != w2 || h1 != h2) {
+    fprintf(stderr, "Error: Image sizes differ, %zux%zu and %zux%zu\n", w1, h1,
+            w2, h2);
+    return 1;
+  }
+
+  long maxDiff = 0;
+  double sumDiff = 0;
+  long differing = 0;
+  for (size_t i = 0; i < w1 * h1; i++) {
+    int d[3] = {abs(reference[i].r - test[i].r), abs(reference[i].g - test[i].g),
+                abs(reference[i].b - test[i].b)};
+    int worst = 0;
+    for (int c = 0; c < 3; c++) {
+      sumDiff += d[c];
+      if (d[c] > worst)
+        worst = d[c];
+    }
+    if (worst > maxDiff)
+      maxDiff = worst;
+    if (worst > COMPARE_TOLERANCE)
+      differing++;
+  }
+
+  double fraction = (double)differing / (w1 * h1);
+  printf("{\"max_channel_diff\": %ld, \"mean_channel_diff\": %.5f, "
+         "\"pixels_over_tolerance\": %ld, \"fraction_over_tolerance\": %.5f, "
+         "\"within_tolerance\": %s}\n",
+         maxDiff, sumDiff / (3.0 * w1 * h1), differing, fraction,
+         fraction < COMPARE_MAX_FRACTION ? "true" : "false");
+  free(reference);
+  free(test);
+  return fraction < COMPARE_MAX_FRACTION ? 0 : 1;
+}
+
+/**
+ *  Main
+ *
+ * @param argc
+ * @param argv
+ * @return 0 if success with all other values representing failure modes
+ */
+int main(int argc, char *argv[]) {
+  Resolution resolutions[MAX_RESOLUTIONS];
+  int numResolutions = 0;
+  int repeats = 1;
+  RenderOptions options = DEFAULT_RENDER_OPTIONS;
+  int firstScene = argc;
+  bool verify = false;
+
+  if (argc == 4 && strcmp(argv[1], "--compare") == 0)
+    return compareImages(argv[2], argv[3]);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      if (numResolutions == MAX_RESOLUTIONS) {
+        fprintf(stderr, "Error: At most %d resolutions are supported\n",
+                MAX_RESOLUTIONS);
+        exit(1);
+      }
+      Resolution *res = &resolutions[numResolutions];
+      if (sscanf(argv[++i], "%dx%d", &res->width, &res->height) != 2 ||
+          res->width < 1 || res->height < 1) {
+        fprintf(stderr, "Error: Bad resolution \"%s\", expected WIDTHxHEIGHT\n",
+                argv[i]);
+        exit(1);
+      }
+      numResolutions++;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      repeats = strtol(argv[++i], (char **)NULL, 10);
+      if (repeats < 1)
+        repeats = 1;
+    } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+      options.aaSamples = strtol(argv[++i], (char **)NULL, 10);
+      if (options.aaSamples < 0 || options.aaSamples > MAX_AA_SAMPLES) {
+        fprintf(stderr, "Error: -a must be between 0 and %d\n", MAX_AA_SAMPLES);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      options.maxBounces = strtol(argv[++i], (char **)NULL, 10);
+      if (options.maxBounces < 0)
+        options.maxBounces = 0;
+    } else if (strcmp(argv[i], "-w") == 0) {
+      options.wavefront = true;
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      verify = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      if (!freopen(argv[++i], "w", stdout)) {
+        fprintf(stderr, "Error: Failed to open file %s\n", argv[i]);
+        exit(1);
+      }
+    } else {
+      firstScene = i;
+      break;
+    }
+  }
+
+  if (firstScene == argc) {
+    printf("%s", cli_help_text);
+    fprintf(stderr, "Error: No scene files given\n");
+    exit(1);
+  }
+
+  if (numResolutions == 0) {
+    resolutions[0] = (Resolution){128, 128};
+    resolutions[1] = (Resolution){512, 512};
+    numResolutions = 2;
+  }
+
+  int failures = 0;
+  bool anyRecord = false;
+  printf("[\n");
+  for (int i = firstScene; i < argc; i++) {
+    // the child writes its records into a pipe, so the separator before
+    // them is only printed once they exist
+    int fds[2];
+    fflush(stdout);
+    if (pipe(fds) < 0) {
+      fprintf(stderr, "Error: Failed to create a pipe\n");
+      exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "Error: Failed to fork benchmark process\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      dup2(fds[1], STDOUT_FILENO);
+      close(fds[1]);
+      exit(verify ? verifyScene(argv[i], resolutions, numResolutions)
+                  : benchScene(argv[i], resolutions, numResolutions, repeats,
+                               &options));
+    }
+
+    close(fds[1]);
+    size_t length = 0, capacity = 4096;
+    char *records = malloc(capacity);
+    ssize_t n;
+    while ((n = read(fds[0], records + length, capacity - length)) > 0) {
+      length += n;
+      if (length == capacity)
+        records = realloc(records, capacity *= 2);
+    }
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    // a child that failed to load, or crashed, may have left half a record
+    bool complete = WIFEXITED(status) && WEXITSTATUS(status) != 1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Error: %s of \"%s\" failed\n",
+              verify ? "Verification" : "Benchmark", argv[i]);
+      failures++;
+    }
+    if (complete && length) {
+      if (anyRecord)
+        printf(",\n");
+      fwrite(records, 1, length, stdout);
+      anyRecord = true;
+    }
+    free(records);
+  }
+  printf("\n]\n");
+  return failures ? 1 : 0;
+}
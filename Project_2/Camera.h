@@ -0,0 +1,52 @@
+#ifndef _CAMERA_H_
+#define _CAMERA_H_
+
+#include "VectorMath.h"
+
+/**
+ * Maps continuous pixel coordinates onto the image plane of the camera
+ */
+typedef struct {
+  real w;
+  real h;
+  int imgWidth;
+  int imgHeight;
+  real pixwidth;
+  real pixheight;
+} View;
+
+/**
+ * Creates the view for an image of the given size through the given camera
+ *
+ * @param w camera width
+ * @param h camera height
+ * @param imgWidth image width in pixels
+ * @param imgHeight image height in pixels
+ * @return the view
+ */
+View makeView(real w, real h, int imgWidth, int imgHeight) {
+  View view = {.w = w, .h = h, .imgWidth = imgWidth, .imgHeight = imgHeight};
+  view.pixwidth = w / imgWidth;
+  view.pixheight = h / imgHeight;
+  return view;
+}
+
+/**
+ * Builds the normalized direction of the ray through a point on the image
+ *
+ * @param view
+ * @param px horizontal pixel coordinate, x + 0.5 is the center of column x
+ * @param py vertical pixel coordinate, y + 0.5 is the center of row y
+ * @param Rd the resulting direction
+ */
+static inline void primaryRay(View *view, real px, real py, real *Rd) {
+  real cx = 0;
+  real cy = 0;
+  // Rd = normalize(P - Ro)
+  Rd[0] = cx - (view->w / 2) + view->pixwidth * px;
+  Rd[1] = -(cy - (view->h / 2) + view->pixheight * py);
+  Rd[2] = 1;
+  normalize(Rd);
+}
+
+#endif
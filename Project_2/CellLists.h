@@ -0,0 +1,82 @@
+#ifndef _CELL_LISTS_H_
+#define _CELL_LISTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Looks up the box of cells an object covers
+ *
+ * @param grid the grid being laid out
+ * @param object index of the object
+ * @param box set to {x0, y0, z0, x1, y1, z1}, inclusive
+ * @return false if the object is in no cell
+ */
+typedef bool (*CellBoxFn)(const void *grid, int object, int *box);
+
+/**
+ * Lays out the candidate lists of a grid of cells in two passes over the
+ * objects' boxes: the first counts the candidates of each cell, the second
+ * fills the lists in scene order. Cell (x, y, z) is at index
+ * (z * dims[1] + y) * dims[0] + x.
+ *
+ * @param dims number of cells along x, y and z
+ * @param wrapX true if x wraps around, so a box may run past either end
+ * @param boxOf the box of each object
+ * @param grid passed on to boxOf
+ * @param numObjects
+ * @param offsets dims[0] * dims[1] * dims[2] + 1 list offsets, filled in
+ * @param indices the candidate lists, freed and allocated anew
+ * @param name what the grid is called in the error message
+ */
+static void fillCellLists(const int *dims, bool wrapX, CellBoxFn boxOf,
+                          const void *grid, int numObjects, int *offsets,
+                          int **indices, const char *name) {
+  int numCells = dims[0] * dims[1] * dims[2];
+  memset(offsets, 0, sizeof(int) * (numCells + 1));
+
+  // first pass: count the candidates of each cell
+  size_t total = 0;
+  int box[6];
+  for (int i = 0; i < numObjects; i++) {
+    if (!boxOf(grid, i, box))
+      continue;
+    for (int z = box[2]; z <= box[5]; z++)
+      for (int y = box[1]; y <= box[4]; y++)
+        for (int k = box[0]; k <= box[3]; k++) {
+          int x = wrapX ? (k % dims[0] + dims[0]) % dims[0] : k;
+          offsets[(z * dims[1] + y) * dims[0] + x + 1]++;
+        }
+    total += (size_t)(box[3] - box[0] + 1) * (box[4] - box[1] + 1) *
+             (box[5] - box[2] + 1);
+  }
+  if (total > INT32_MAX) {
+    fprintf(stderr, "Error: Too many %s candidates (%zu)\n", name, total);
+    exit(1);
+  }
+
+  for (int cell = 0; cell < numCells; cell++)
+    offsets[cell + 1] += offsets[cell];
+
+  // second pass: fill the lists in scene order
+  free(*indices);
+  *indices = malloc(sizeof(int) * (total ? total : 1));
+  int *fill = malloc(sizeof(int) * numCells);
+  memcpy(fill, offsets, sizeof(int) * numCells);
+  for (int i = 0; i < numObjects; i++) {
+    if (!boxOf(grid, i, box))
+      continue;
+    for (int z = box[2]; z <= box[5]; z++)
+      for (int y = box[1]; y <= box[4]; y++)
+        for (int k = box[0]; k <= box[3]; k++) {
+          int x = wrapX ? (k % dims[0] + dims[0]) % dims[0] : k;
+          (*indices)[fill[(z * dims[1] + y) * dims[0] + x]++] = i;
+        }
+  }
+  free(fill);
+}
+
+#endif
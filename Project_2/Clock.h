@@ -0,0 +1,15 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <time.h>
+
+/**
+ * Monotonic wall clock in milliseconds
+ */
+static double nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+#endif
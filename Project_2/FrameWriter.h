@@ -0,0 +1,194 @@
+#ifndef _FRAMEWRITER_H_
+#define _FRAMEWRITER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PixTool.h"
+
+/**
+ * Encodes and writes finished frames on a background thread so the next
+ * frame renders meanwhile. Frames go either to numbered files, named by a
+ * printf pattern such as "frame%04d.ppm", or back to back into one PPM
+ * stream. One frame can be waiting while another is written; submitting a
+ * third blocks until the writer catches up.
+ */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  // signalled when a frame is queued or the writer is closed
+  pthread_cond_t queued;
+  // signalled when the writer has taken the queued frame
+  pthread_cond_t taken;
+
+  int width;
+  int height;
+  // the frame waiting to be written and the one being written
+  Pixel *pending;
+  Pixel *writing;
+  int pendingNumber;
+  bool hasPending;
+  bool closing;
+  bool failed;
+
+  const char *pattern;
+  FILE *stream;
+} FrameWriter;
+
+/**
+ * Checks that a numbered output pattern holds exactly one integer
+ * conversion (%d with optional zero padding and width) and nothing else
+ * printf would interpret
+ */
+bool validFramePattern(const char *pattern) {
+  int conversions = 0;
+  for (const char *p = pattern; *p; p++) {
+    if (*p != '%')
+      continue;
+    p++;
+    if (*p == '%')
+      continue;
+    while (*p >= '0' && *p <= '9')
+      p++;
+    if (*p != 'd')
+      return false;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+static bool writeFrame(FrameWriter *writer, Pixel *frame, int number) {
+  if (writer->stream) {
+    bufferToBinary(frame, writer->width, writer->height, writer->stream);
+    return !ferror(writer->stream);
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), writer->pattern, number);
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "Error: Failed to open file %s\n", path);
+    return false;
+  }
+  bufferToBinary(frame, writer->width, writer->height, out);
+  return fclose(out) == 0;
+}
+
+static void *frameWriterThread(void *arg) {
+  FrameWriter *writer = arg;
+  pthread_mutex_lock(&writer->lock);
+  while (1) {
+    while (!writer->hasPending && !writer->closing)
+      pthread_cond_wait(&writer->queued, &writer->lock);
+    if (!writer->hasPending)
+      break;
+
+    Pixel *frame = writer->pending;
+    writer->pending = writer->writing;
+    writer->writing = frame;
+    int number = writer->pendingNumber;
+    writer->hasPending = false;
+    pthread_cond_signal(&writer->taken);
+
+    pthread_mutex_unlock(&writer->lock);
+    bool ok = writeFrame(writer, frame, number);
+    pthread_mutex_lock(&writer->lock);
+    if (!ok)
+      writer->failed = true;
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return NULL;
+}
+
+/**
+ * Starts the writer thread
+ *
+ * @param writer
+ * @param width frame size in pixels
+ * @param height
+ * @param pattern printf pattern for numbered files, or NULL to use stream
+ * @param stream file receiving every frame in turn when pattern is NULL
+ * @return false if the writer could not be started, in which case nothing
+ * is left to close
+ */
+bool openFrameWriter(FrameWriter *writer, int width, int height,
+                     const char *pattern, FILE *stream) {
+  memset(writer, 0, sizeof(FrameWriter));
+  writer->width = width;
+  writer->height = height;
+  writer->pattern = pattern;
+  writer->stream = pattern ? NULL : stream;
+
+  size_t frameBytes = sizeof(Pixel) * (size_t)width * height;
+  writer->pending = malloc(frameBytes);
+  writer->writing = malloc(frameBytes);
+  if (!writer->pending || !writer->writing) {
+    fprintf(stderr, "Error: Out of memory allocating frame buffers\n");
+    free(writer->pending);
+    free(writer->writing);
+    return false;
+  }
+
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->queued, NULL);
+  pthread_cond_init(&writer->taken, NULL);
+  if (pthread_create(&writer->thread, NULL, frameWriterThread, writer) != 0) {
+    fprintf(stderr, "Error: Failed to start the frame writer\n");
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued);
+    pthread_cond_destroy(&writer->taken);
+    free(writer->pending);
+    free(writer->writing);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Hands a finished frame to the writer. The frame is copied, so the caller
+ * may start rendering the next one into the same buffer at once.
+ *
+ * @param writer
+ * @param frame width * height pixels
+ * @param number the frame number, used to name numbered files
+ * @return false if writing an earlier frame failed
+ */
+bool submitFrame(FrameWriter *writer, Pixel *frame, int number) {
+  pthread_mutex_lock(&writer->lock);
+  while (writer->hasPending)
+    pthread_cond_wait(&writer->taken, &writer->lock);
+  memcpy(writer->pending, frame,
+         sizeof(Pixel) * (size_t)writer->width * writer->height);
+  writer->pendingNumber = number;
+  writer->hasPending = true;
+  bool ok = !writer->failed;
+  pthread_cond_signal(&writer->queued);
+  pthread_mutex_unlock(&writer->lock);
+  return ok;
+}
+
+/**
+ * Writes out any queued frame, stops the thread and frees the buffers
+ *
+ * @param writer
+ * @return false if any frame failed to write
+ */
+bool closeFrameWriter(FrameWriter *writer) {
+  pthread_mutex_lock(&writer->lock);
+  writer->closing = true;
+  pthread_cond_signal(&writer->queued);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+
+  pthread_mutex_destroy(&writer->lock);
+  pthread_cond_destroy(&writer->queued);
+  pthread_cond_destroy(&writer->taken);
+  free(writer->pending);
+  free(writer->writing);
+  return !writer->failed;
+}
+
+#endif
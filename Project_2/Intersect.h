@@ -0,0 +1,119 @@
+#ifndef _INTERSECT_H_
+#define _INTERSECT_H_
+
+#include <math.h>
+
+#include "Scene.h"
+#include "VectorMath.h"
+
+/**
+ * Finds the intersection with a plane by the formula provided in class/text
+ *
+ * @param Ro
+ * @param Rd
+ * @param plane
+ * @return real representing the intersection
+ */
+real planeIntersection(real *Ro, real *Rd, const PlaneGeom *plane) {
+  real position[3] = {plane->position[0], plane->position[1], plane->position[2]};
+  real normal[3] = {plane->normal[0], plane->normal[1], plane->normal[2]};
+
+  // distance = dot(Po-Lo,N)/dot(L,N)
+  real temp[3];
+  vectorSubtract(Ro, position, temp);
+  real distance = vectorDot(normal, temp);
+
+  real denominator = vectorDot(normal, Rd);
+  distance = -(distance / denominator);
+  if (distance > 0)
+    return distance;
+
+  return 0;
+}
+
+/**
+ *  Finds the intersection with a sphere using the formula provided in class/text
+ * @param Ro
+ * @param Rd
+ * @param sphere
+ * @return real representing the intersection
+ */
+real sphereIntersection(real *Ro, real *Rd, const SphereGeom *sphere) {
+  real Center[3] = {sphere->center[0], sphere->center[1], sphere->center[2]};
+
+  real a = (sqr(Rd[0]) + sqr(Rd[1]) + sqr(Rd[2]));
+  real b = (2 * (Ro[0] * Rd[0] - Rd[0] * Center[0] + Ro[1] * Rd[1] -
+                   Rd[1] * Center[1] + Ro[2] * Rd[2] - Rd[2] * Center[2]));
+  real c = sqr(Ro[0] - Center[0]) + sqr(Ro[1] - Center[1]) +
+             sqr(Ro[2] - Center[2]) - sphere->radius2;
+
+  real det = sqr(b) - 4 * a * c;
+  if (det < 0)
+    return -1;
+
+  det = sqrt(det);
+
+  real t0 = (-b - det) / (2 * a);
+  if (t0 > 0)
+    return t0;
+
+  real t1 = (-b + det) / (2 * a);
+  if (t1 > 0)
+    return t1;
+
+  return -1;
+}
+
+/**
+ * Tests every plane of the scene, planes are unbounded so no culling applies
+ *
+ * @param scene
+ * @param Ro
+ * @param Rd
+ * @param max closest distance so far, updated on a closer hit
+ * @param hit index of the closest object so far, updated on a closer hit
+ */
+static inline void closestPlane(Scene *scene, real *Ro, real *Rd, real *max,
+                                int *hit) {
+  for (size_t j = 0; j < scene->numPlanes; j++) {
+    real t = planeIntersection(Ro, Rd, &scene->planes[j]);
+    if (t > 0 && t < *max) {
+      *max = t;
+      *hit = scene->numSpheres + j;
+    }
+  }
+}
+
+/**
+ * Finds the closest object along a ray among a list of candidate spheres,
+ * e.g. the spheres binned into the screen tile a primary ray goes through,
+ * and all planes
+ *
+ * @param scene
+ * @param candidates sphere indices, in scene order
+ * @param count number of candidates
+ * @param Ro
+ * @param Rd
+ * @param t set to the distance to the closest object
+ * @return the index of the closest object, or -1 if nothing is hit
+ */
+static inline int closestCandidate(Scene *scene, int *candidates, int count,
+                                   real *Ro, real *Rd, real *t) {
+  real max = INFINITY;
+  int hit = -1;
+
+  for (int c = 0; c < count; c++) {
+    int i = candidates[c];
+    real t = sphereIntersection(Ro, Rd, &scene->spheres[i]);
+    if (t > 0 && t < max) {
+      max = t;
+      hit = i;
+    }
+  }
+  closestPlane(scene, Ro, Rd, &max, &hit);
+
+  *t = max;
+  return hit;
+}
+
+#endif
@@ -9,9 +9,9 @@
 
 #include "VectorMath.h"
 #include "RayTracer.h"
+#include "Scene.h"
 
 int line = 1;
-const uint8_t INIT_NUM_OBJ = 64;
 
 /**
  * Wrapper for the getc() func, adds error checking and line-number maintainance
@@ -92,7 +92,9 @@ char *nextString(FILE *json) {
     c = nextC(json);
   }
   buffer[i] = 0;
-  return strdup(buffer);
+  char *str = malloc(i + 1);
+  memcpy(str, buffer, i + 1);
+  return str;
 }
 
 /**
@@ -116,8 +118,8 @@ double nextNumber(FILE *json) {
  * @param json
  * @return
  */
-double *nextVector(FILE *json) {
-  double *v = malloc(3 * sizeof(double));
+real *nextVector(FILE *json) {
+  real *v = malloc(3 * sizeof(real));
     expectC(json, '[');
     skipWs(json);
   v[0] = nextNumber(json);
@@ -136,21 +138,24 @@ double *nextVector(FILE *json) {
 }
 
 /**
- * Loads the scene from a given file into an object struct array as defined in tracer.h
+ * Loads the scene from a given file into the packed arrays of a Scene as
+ * defined in Scene.h
  *
  * @param filename
- * @return
+ * @return the scene, or NULL if the file holds no objects
  */
-Object **readScene(char *filename) {
+Scene *readScene(char *filename) {
   int c;
+  line = 1;
   FILE *json = fopen(filename, "r");
   if (json == NULL) {
     fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
     exit(1);
   }
 
-  Object **objArray;
-  objArray = malloc(sizeof(Object *) * INIT_NUM_OBJ);
+  // each object is parsed into a temporary and then packed into the scene
+  Scene *scene = newScene();
+  Object object;
 
     skipWs(json);
 
@@ -158,14 +163,14 @@ Object **readScene(char *filename) {
     expectC(json, '[');
     skipWs(json);
 
-  size_t curr_obj = 0;
   while (1) {
-    objArray[curr_obj] = malloc(sizeof(Object));
+    memset(&object, 0, sizeof(Object));
 
     c = fgetc(json);
     if (c == ']') {
       fprintf(stderr, "Error: This is the worst scene file EVER.\n");
       fclose(json);
+      freeScene(scene);
       return NULL;
     }
     if (c == '{') {
@@ -186,16 +191,20 @@ Object **readScene(char *filename) {
       char *value = nextString(json);
 
       if (strcmp(value, "camera") == 0) {
-        objArray[curr_obj]->type = CAMERA;
+        object.type = CAMERA;
       } else if (strcmp(value, "sphere") == 0) {
-        objArray[curr_obj]->type = SPHERE;
+        object.type = SPHERE;
       } else if (strcmp(value, "plane") == 0) {
-        objArray[curr_obj]->type = PLANE;
+        object.type = PLANE;
+      } else if (strcmp(value, "light") == 0) {
+        object.type = LIGHT;
       } else {
         fprintf(stderr, "Error: Unknown type, \"%s\", on line number %d.\n",
                 value, line);
         exit(1);
       }
+      free(key);
+      free(value);
 
         skipWs(json);
 
@@ -222,7 +231,7 @@ Object **readScene(char *filename) {
               exit(1);
             }
 
-            objArray[curr_obj]->Camera.width = value;
+            object.Camera.width = value;
 
           } else if (strcmp(key, "height") == 0) {
             double value = nextNumber(json);
@@ -233,7 +242,7 @@ Object **readScene(char *filename) {
               exit(1);
             }
 
-            objArray[curr_obj]->Camera.height = value;
+            object.Camera.height = value;
           } else if (strcmp(key, "radius") == 0) {
             double value = nextNumber(json);
             if (value < 0) {
@@ -243,12 +252,23 @@ Object **readScene(char *filename) {
               exit(1);
             }
 
-            objArray[curr_obj]->Sphere.radius = value;
+            object.Sphere.radius = value;
           }
 
-          else if (strcmp(key, "color") == 0) {
-            double *value = nextVector(json);
-            objArray[curr_obj]->color.r = value[0];
+          else if (strcmp(key, "color") == 0 && object.type == LIGHT) {
+            real *value = nextVector(json);
+            if (value[0] < 0 || value[1] < 0 || value[2] < 0) {
+              fprintf(stderr, "Error: color values cannot be less than 0. "
+                              "On line number %d.\n",
+                      line);
+              exit(1);
+            }
+            vectorCopy(object.Light.color, value);
+            free(value);
+          } else if (strcmp(key, "color") == 0 ||
+                     strcmp(key, "diffuse_color") == 0 ||
+                     strcmp(key, "specular_color") == 0) {
+            real *value = nextVector(json);
             if (value[0] < 0 || value[1] < 0 || value[2] < 0) {
               fprintf(stderr, "Error: color values cannot be less than 0. "
                               "On line number %d.\n",
@@ -256,29 +276,91 @@ Object **readScene(char *filename) {
               exit(1);
             }
 
-            objArray[curr_obj]->color.g = value[1];
-            objArray[curr_obj]->color.b = value[2];
+            Pixel *color = strcmp(key, "specular_color") == 0
+                               ? &object.specularColor
+                               : &object.color;
+            color->r = value[0];
+            color->g = value[1];
+            color->b = value[2];
+            free(value);
+          } else if (strcmp(key, "ns") == 0) {
+            double value = nextNumber(json);
+            if (value < 0) {
+              fprintf(stderr, "Error: ns cannot be less than 0. Found %lf "
+                              "on line number %d.\n",
+                      value, line);
+              exit(1);
+            }
+            object.shininess = value;
+          } else if (strcmp(key, "reflectivity") == 0) {
+            double value = nextNumber(json);
+            if (value < 0 || value > 1) {
+              fprintf(stderr, "Error: reflectivity must be between 0 and 1. "
+                              "Found %lf on line number %d.\n",
+                      value, line);
+              exit(1);
+            }
+            object.reflectivity = value;
           } else if (strcmp(key, "position") == 0) {
-            double *value = nextVector(json);
-
-            if (objArray[curr_obj]->type == PLANE) {
-                vectorCopy(objArray[curr_obj]->Plane.position, value);
-            } else if (objArray[curr_obj]->type == SPHERE) {
-                vectorCopy(objArray[curr_obj]->Sphere.position, value);
+            real *value = nextVector(json);
+
+            if (object.type == PLANE) {
+                vectorCopy(object.Plane.position, value);
+            } else if (object.type == SPHERE) {
+                vectorCopy(object.Sphere.position, value);
+            } else if (object.type == LIGHT) {
+                vectorCopy(object.Light.position, value);
             } else {
               fprintf(stderr, "Error: Unknown type, \"%d\", on line %d.\n",
-                      objArray[curr_obj]->type, line);
+                      object.type, line);
+              exit(1);
+            }
+            free(value);
+
+          } else if (strcmp(key, "velocity") == 0) {
+            real *value = nextVector(json);
+            if (object.type != SPHERE) {
+              fprintf(stderr, "Error: Only spheres can have a velocity. On "
+                              "line number %d.\n",
+                      line);
+              exit(1);
+            }
+            vectorCopy(object.Sphere.velocity, value);
+            free(value);
+
+          } else if (object.type == LIGHT &&
+                     strcmp(key, "direction") == 0) {
+            real *value = nextVector(json);
+            vectorCopy(object.Light.direction, value);
+            free(value);
+
+          } else if (object.type == LIGHT &&
+                     (strcmp(key, "theta") == 0 ||
+                      strncmp(key, "radial-a", 8) == 0 ||
+                      strcmp(key, "angular-a0") == 0)) {
+            double value = nextNumber(json);
+            if (strcmp(key, "theta") == 0) {
+              object.Light.theta = value;
+            } else if (strcmp(key, "angular-a0") == 0) {
+              object.Light.angular0 = value;
+            } else if (key[8] >= '0' && key[8] <= '2' && key[9] == 0) {
+              object.Light.radial[key[8] - '0'] = value;
+            } else {
+              fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n",
+                      key, line);
               exit(1);
             }
 
           } else if (strcmp(key, "normal") == 0) {
-            double *value = nextVector(json);
-              vectorCopy(objArray[curr_obj]->Plane.normal, value);
+            real *value = nextVector(json);
+              vectorCopy(object.Plane.normal, value);
+            free(value);
           } else {
             fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n",
                     key, line);
             exit(1);
           }
+          free(key);
 
             skipWs(json);
         } else {
@@ -289,18 +371,17 @@ Object **readScene(char *filename) {
 
         skipWs(json);
       c = nextC(json);
+      sceneAddObject(scene, &object);
       if (c == ',') {
           skipWs(json);
       } else if (c == ']') {
         fclose(json);
-        objArray[curr_obj + 1] = 0;
-        return objArray;
+        return scene;
       } else {
         fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
         exit(1);
       }
     }
-    curr_obj++;
   }
 }
 
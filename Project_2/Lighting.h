@@ -0,0 +1,384 @@
+#ifndef _LIGHTING_H_
+#define _LIGHTING_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CellLists.h"
+#include "Intersect.h"
+#include "PixTool.h"
+#include "Scene.h"
+#include "VectorMath.h"
+
+/**
+ * Bins of the direction grid around each light, by polar angle and azimuth
+ */
+#define LIGHT_GRID_ROWS 64
+#define LIGHT_GRID_COLS 128
+
+/**
+ * Shadow rays start this far off the surface so they cannot hit it again
+ */
+#define SHADOW_BIAS 1e-3
+
+/**
+ * The spheres a light can see in each direction, the light's counterpart of
+ * the screen tile grid. Directions from the light are binned by polar angle
+ * (rows) and azimuth (columns), and each bin lists every sphere whose
+ * silhouette reaches into it, so a shadow ray only tests the spheres along
+ * its direction. The lists are stored back to back as in TileGrid.
+ */
+typedef struct {
+  int *offsets;
+  int *indices;
+  // bin range {row0, row1, col0, col1} covered by each sphere, see
+  // sphereLightCells()
+  int *ranges;
+} LightGrid;
+
+/**
+ * Shadow ray counters
+ */
+typedef struct {
+  long rays;
+  long tests;
+  // rays resolved by their tile's last occluder for the light
+  long cacheHits;
+  long occluded;
+} ShadowStats;
+
+/**
+ * The bin of a unit direction pointing away from the light
+ */
+static inline int lightCell(real *d) {
+  real z = d[2] < -1 ? -1 : d[2] > 1 ? 1 : d[2];
+  int row = acos(z) / PI * LIGHT_GRID_ROWS;
+  int col = (atan2(d[1], d[0]) + PI) / (2 * PI) * LIGHT_GRID_COLS;
+  if (row >= LIGHT_GRID_ROWS)
+    row = LIGHT_GRID_ROWS - 1;
+  if (col >= LIGHT_GRID_COLS)
+    col = LIGHT_GRID_COLS - 1;
+  if (col < 0)
+    col = 0;
+  return row * LIGHT_GRID_COLS + col;
+}
+
+/**
+ * Finds the bins a sphere covers as seen from a light: the cone around the
+ * direction to its center with half-angle asin(r / d). Its azimuth span is
+ * +-asin(sin(half-angle) / sin(polar angle)) unless the cone holds a pole.
+ *
+ * @param light
+ * @param sphere
+ * @param range set to {row0, row1, col0, col1}, inclusive; the columns may
+ * run past either end and wrap around
+ */
+static void sphereLightCells(const LightGeom *light, const SphereGeom *sphere,
+                             int *range) {
+  double c[3];
+  for (int a = 0; a < 3; a++)
+    c[a] = sphere->center[a] - light->position[a];
+  double d = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+  double r = sqrt(sphere->radius2);
+
+  // a sphere around the light blocks every direction
+  range[0] = 0;
+  range[1] = LIGHT_GRID_ROWS - 1;
+  range[2] = 0;
+  range[3] = LIGHT_GRID_COLS - 1;
+  if (d <= r * (1 + 1e-6) + 1e-6)
+    return;
+
+  // some slack absorbs rounding in the bin lookup
+  double alpha = asin(r / d) + 1e-3;
+  double theta = acos(fmax(-1, fmin(1, c[2] / d)));
+  double lo = theta - alpha, hi = theta + alpha;
+  range[0] = lo <= 0 ? 0 : (int)(lo / PI * LIGHT_GRID_ROWS);
+  range[1] = hi >= PI ? LIGHT_GRID_ROWS - 1
+                      : (int)(hi / PI * LIGHT_GRID_ROWS);
+  if (range[1] >= LIGHT_GRID_ROWS)
+    range[1] = LIGHT_GRID_ROWS - 1;
+  if (lo <= 0 || hi >= PI)
+    return;
+
+  double dphi = asin(fmin(1, sin(alpha) / sin(theta)));
+  double phi = atan2(c[1], c[0]) + PI;
+  int col0 = floor((phi - dphi) / (2 * PI) * LIGHT_GRID_COLS);
+  int col1 = floor((phi + dphi) / (2 * PI) * LIGHT_GRID_COLS);
+  if (col1 - col0 + 1 >= LIGHT_GRID_COLS)
+    return;
+  range[2] = col0;
+  range[3] = col1;
+}
+
+/**
+ * The bins a sphere covers, as a box for fillCellLists(): columns along x
+ * and rows along y
+ */
+static bool lightBox(const void *grid, int object, int *box) {
+  const int *range = &((const LightGrid *)grid)->ranges[4 * object];
+  box[0] = range[2];
+  box[1] = range[0];
+  box[2] = 0;
+  box[3] = range[3];
+  box[4] = range[1];
+  box[5] = 0;
+  return true;
+}
+
+/**
+ * Lays out the candidate lists of every bin from the spheres' bin ranges,
+ * with the columns wrapping around
+ *
+ * @param grid a grid whose ranges are filled in
+ * @param numObjects number of spheres
+ */
+static void fillLightLists(LightGrid *grid, int numObjects) {
+  int dims[3] = {LIGHT_GRID_COLS, LIGHT_GRID_ROWS, 1};
+  fillCellLists(dims, true, lightBox, grid, numObjects, grid->offsets,
+                &grid->indices, "light grid");
+}
+
+/**
+ * Bins every sphere of the scene into the directions it covers from a light
+ *
+ * @param grid the grid to fill, freed with freeLightGrid()
+ * @param scene
+ * @param light
+ */
+void buildLightGrid(LightGrid *grid, Scene *scene, const LightGeom *light) {
+  int numObjects = scene->numSpheres;
+  grid->ranges = malloc(sizeof(int) * 4 * (numObjects ? numObjects : 1));
+  grid->offsets = malloc(sizeof(int) * (LIGHT_GRID_ROWS * LIGHT_GRID_COLS + 1));
+  grid->indices = NULL;
+  for (int i = 0; i < numObjects; i++)
+    sphereLightCells(light, &scene->spheres[i], &grid->ranges[4 * i]);
+  fillLightLists(grid, numObjects);
+}
+
+/**
+ * Refits a light's grid after some spheres moved: only those are binned
+ * again, and the lists are laid out anew only if one of them now covers
+ * other bins
+ *
+ * @param grid a grid built with buildLightGrid() for the same light
+ * @param scene
+ * @param light
+ * @param moved indices of the spheres that moved
+ * @param numMoved
+ * @return true if the candidate lists changed
+ */
+bool refitLightGrid(LightGrid *grid, Scene *scene, const LightGeom *light,
+                    const int *moved, int numMoved) {
+  bool changed = false;
+  for (int k = 0; k < numMoved; k++) {
+    int *range = &grid->ranges[4 * moved[k]];
+    int refit[4];
+    sphereLightCells(light, &scene->spheres[moved[k]], refit);
+    if (memcmp(range, refit, sizeof(refit)) != 0) {
+      memcpy(range, refit, sizeof(refit));
+      changed = true;
+    }
+  }
+  if (changed)
+    fillLightLists(grid, scene->numSpheres);
+  return changed;
+}
+
+void freeLightGrid(LightGrid *grid) {
+  free(grid->offsets);
+  free(grid->indices);
+  free(grid->ranges);
+  grid->offsets = NULL;
+  grid->indices = NULL;
+  grid->ranges = NULL;
+}
+
+/**
+ * True if the object with the given hit index lies on the shadow ray
+ * between its origin and the light
+ */
+static inline bool blocksShadowRay(Scene *scene, int hit, real *origin,
+                                   real *L, real dist) {
+  real t;
+  if (hit < (long)scene->numSpheres)
+    t = sphereIntersection(origin, L, &scene->spheres[hit]);
+  else
+    t = planeIntersection(origin, L, &scene->planes[hit - scene->numSpheres]);
+  return t > 0 && t < dist;
+}
+
+/**
+ * Any-hit query: is anything between a surface point and a light? Stops at
+ * the first occluder found instead of looking for the closest, and tries
+ * the occluder that shadowed the previous ray first, which neighbouring
+ * pixels very often share.
+ *
+ * @param scene
+ * @param grid the light's direction grid
+ * @param origin start of the shadow ray, just off the surface
+ * @param L unit direction towards the light
+ * @param dist distance to the light
+ * @param lastOccluder hit index of the last occluder for this light, -1 if
+ * none; updated when another one is found
+ * @param stats
+ * @return true if the light is blocked
+ */
+bool occluded(Scene *scene, LightGrid *grid, real *origin, real *L, real dist,
+              int *lastOccluder, ShadowStats *stats) {
+  stats->rays++;
+  int last = *lastOccluder;
+  if (last >= 0) {
+    stats->tests++;
+    if (blocksShadowRay(scene, last, origin, L, dist)) {
+      stats->cacheHits++;
+      stats->occluded++;
+      return true;
+    }
+  }
+
+  int numSpheres = scene->numSpheres;
+  for (size_t j = 0; j < scene->numPlanes; j++) {
+    if (numSpheres + (int)j == last)
+      continue;
+    stats->tests++;
+    real t = planeIntersection(origin, L, &scene->planes[j]);
+    if (t > 0 && t < dist) {
+      *lastOccluder = numSpheres + j;
+      stats->occluded++;
+      return true;
+    }
+  }
+
+  // the bin is looked up by the direction from the light to the point
+  real back[3] = {-L[0], -L[1], -L[2]};
+  int cell = lightCell(back);
+  for (int c = grid->offsets[cell]; c < grid->offsets[cell + 1]; c++) {
+    int i = grid->indices[c];
+    if (i == last)
+      continue;
+    stats->tests++;
+    real t = sphereIntersection(origin, L, &scene->spheres[i]);
+    if (t > 0 && t < dist) {
+      *lastOccluder = i;
+      stats->occluded++;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Unit surface normal of the object with the given hit index at P
+ */
+static inline void surfaceNormal(Scene *scene, int hit, real *P, real *N) {
+  if (hit < (long)scene->numSpheres) {
+    const SphereGeom *sphere = &scene->spheres[hit];
+    for (int a = 0; a < 3; a++)
+      N[a] = P[a] - sphere->center[a];
+  } else {
+    const PlaneGeom *plane = &scene->planes[hit - scene->numSpheres];
+    for (int a = 0; a < 3; a++)
+      N[a] = plane->normal[a];
+  }
+  normalize(N);
+}
+
+/**
+ * Shades a ray's closest hit. Without lights this is the object's flat
+ * color, as before lights existed; otherwise the diffuse and specular
+ * contributions of every light that reaches the point, with shadow rays
+ * answered by occluded().
+ *
+ * @param scene
+ * @param grids one direction grid per light
+ * @param hit hit index of the closest object, -1 for none
+ * @param t distance along the ray to the hit
+ * @param Ro
+ * @param Rd unit ray direction
+ * @param occluders last occluder of each light, shared by nearby rays
+ * @param stats
+ * @return the color seen along the ray
+ */
+Pixel shadeHit(Scene *scene, LightGrid *grids, int hit, real t, real *Ro,
+               real *Rd, int *occluders, ShadowStats *stats) {
+  Pixel black = {.r = 0, .g = 0, .b = 0};
+  if (hit < 0)
+    return black;
+  Pixel diffuse = sceneColor(scene, hit);
+  if (!scene->numLights)
+    return diffuse;
+  const Material *material = sceneMaterial(scene, hit);
+
+  real P[3], N[3], origin[3];
+  for (int a = 0; a < 3; a++)
+    P[a] = Ro[a] + t * Rd[a];
+  surfaceNormal(scene, hit, P, N);
+  // light the side facing the viewer
+  if (vectorDot(N, Rd) > 0)
+    vectorScale(N, -1, N);
+  for (int a = 0; a < 3; a++)
+    origin[a] = P[a] + SHADOW_BIAS * N[a];
+
+  double sum[3] = {0, 0, 0};
+  for (size_t l = 0; l < scene->numLights; l++) {
+    const LightGeom *light = &scene->lights[l];
+    real L[3];
+    for (int a = 0; a < 3; a++)
+      L[a] = light->position[a] - P[a];
+    real dist = sqrt(vectorDot(L, L));
+    if (dist <= 0)
+      continue;
+    vectorScale(L, 1 / dist, L);
+
+    real NdotL = vectorDot(N, L);
+    if (NdotL <= 0)
+      continue;
+
+    double denominator =
+        light->radial[0] + light->radial[1] * dist + light->radial[2] * dist * dist;
+    double attenuation = denominator > 0 ? 1 / denominator : 1;
+    if (light->spot) {
+      real axis[3] = {light->direction[0], light->direction[1],
+                      light->direction[2]};
+      real cosAngle = -vectorDot(L, axis);
+      if (cosAngle < light->cosTheta)
+        continue;
+      attenuation *= pow(cosAngle, light->angular0);
+    }
+
+    // only lit points that would receive light pay for a shadow ray
+    if (occluded(scene, &grids[l], origin, L, dist, &occluders[l], stats))
+      continue;
+
+    double highlight = 0;
+    if (material) {
+      // reflect L about N and compare with the direction to the viewer
+      real R[3];
+      for (int a = 0; a < 3; a++)
+        R[a] = 2 * NdotL * N[a] - L[a];
+      real RdotV = -vectorDot(R, Rd);
+      if (RdotV > 0)
+        highlight = pow(RdotV, material->shininess);
+    }
+
+    double s[3] = {material ? material->specular.r * highlight : 0,
+                   material ? material->specular.g * highlight : 0,
+                   material ? material->specular.b * highlight : 0};
+    sum[0] += light->color[0] * attenuation * (diffuse.r * NdotL + s[0]);
+    sum[1] += light->color[1] * attenuation * (diffuse.g * NdotL + s[1]);
+    sum[2] += light->color[2] * attenuation * (diffuse.b * NdotL + s[2]);
+  }
+
+  Pixel color;
+  color.r = sum[0] >= 255 ? 255 : (uint8_t)(sum[0] + 0.5);
+  color.g = sum[1] >= 255 ? 255 : (uint8_t)(sum[1] + 0.5);
+  color.b = sum[2] >= 255 ? 255 : (uint8_t)(sum[2] + 0.5);
+  return color;
+}
+
+#endif
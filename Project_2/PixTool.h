@@ -12,6 +12,9 @@
  */
 typedef struct { uint8_t r, g, b; } Pixel;
 
+// pixel buffers are written and read as raw P6 data
+_Static_assert(sizeof(Pixel) == 3, "Pixel must be 3 packed bytes");
+
 /**
  * Writes a given pixel buffer to an output binary file
  * (essentially creates a screenshot of a given pixel buffer state)
@@ -24,13 +27,32 @@ typedef struct { uint8_t r, g, b; } Pixel;
 void bufferToBinary(Pixel *buffer, size_t width, size_t height,
                     FILE *output_file) {
   fprintf(output_file, "P6\n");
-  fprintf(output_file, "%u %u\n", width, height);
+  fprintf(output_file, "%zu %zu\n", width, height);
   fprintf(output_file, "255\n");
-  for (int i = 0; i < width * height; i++) {
-    fputc(buffer[i].r, output_file);
-    fputc(buffer[i].g, output_file);
-    fputc(buffer[i].b, output_file);
+  fwrite(buffer, sizeof(Pixel), width * height, output_file);
+}
+
+/**
+ * Reads a binary (P6) PPM file with a maxval of 255 into a new pixel buffer
+ *
+ * @param input_file the input file handle
+ * @param width set to the image width in pixels
+ * @param height set to the image height in pixels
+ * @return the pixel buffer, or NULL if the file is not a supported PPM
+ */
+Pixel *binaryToBuffer(FILE *input_file, size_t *width, size_t *height) {
+  int maxval;
+  if (fscanf(input_file, "P6 %zu %zu %d", width, height, &maxval) != 3 ||
+      maxval != 255 || fgetc(input_file) == EOF)
+    return NULL;
+
+  Pixel *buffer = malloc(sizeof(Pixel) * *width * *height);
+  if (fread(buffer, sizeof(Pixel), *width * *height, input_file) !=
+      *width * *height) {
+    free(buffer);
+    return NULL;
   }
+  return buffer;
 }
 
 #endif
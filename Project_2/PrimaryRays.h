@@ -0,0 +1,203 @@
+#ifndef _PRIMARYRAYS_H_
+#define _PRIMARYRAYS_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Scene.h"
+#include "VectorMath.h"
+
+/**
+ * A sphere as seen from the camera. With the ray origin at the camera (the
+ * origin) and a unit direction D, the ray's quadratic reduces to
+ * t^2 - 2 (D . C) t + c, where only c depends on the sphere alone.
+ */
+typedef struct {
+  real center[3];
+  // |C|^2 - r^2
+  real c;
+} PrimarySphere;
+
+/**
+ * A plane as seen from the camera: a ray along D meets it at
+ * t = offset / (N . D)
+ */
+typedef struct {
+  real normal[3];
+  // N . P, the plane's signed distance from the camera along its normal
+  real offset;
+} PrimaryPlane;
+
+/**
+ * The scene compiled for primary rays, which all start at the camera and
+ * have a unit direction. Rays that start anywhere else (shadows,
+ * reflections) keep using the general tests of Intersect.h.
+ */
+typedef struct {
+  size_t numSpheres;
+  size_t sphereCapacity;
+  PrimarySphere *spheres;
+  size_t numPlanes;
+  size_t planeCapacity;
+  PrimaryPlane *planes;
+} CompiledScene;
+
+/**
+ * Computes the invariants of one sphere for a camera at the origin
+ */
+static inline void compileSphere(const SphereGeom *sphere,
+                                 PrimarySphere *compiled) {
+  real c = -sphere->radius2;
+  for (int a = 0; a < 3; a++) {
+    compiled->center[a] = sphere->center[a];
+    c += sqr(compiled->center[a]);
+  }
+  compiled->c = c;
+}
+
+/**
+ * Computes the per-primitive invariants of every sphere and plane for a
+ * camera at the origin. Arrays are kept and reused when compiling again,
+ * e.g. after spheres moved.
+ *
+ * @param compiled the compiled scene, freed with freeCompiledScene()
+ * @param scene
+ */
+void compileScene(CompiledScene *compiled, Scene *scene) {
+  if (scene->numSpheres > compiled->sphereCapacity) {
+    compiled->spheres = realloc(compiled->spheres,
+                                sizeof(PrimarySphere) * scene->numSpheres);
+    compiled->sphereCapacity = scene->numSpheres;
+  }
+  if (scene->numPlanes > compiled->planeCapacity) {
+    compiled->planes =
+        realloc(compiled->planes, sizeof(PrimaryPlane) * scene->numPlanes);
+    compiled->planeCapacity = scene->numPlanes;
+  }
+  if ((scene->numSpheres && !compiled->spheres) ||
+      (scene->numPlanes && !compiled->planes)) {
+    fprintf(stderr, "Error: Out of memory compiling the scene\n");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < scene->numSpheres; i++)
+    compileSphere(&scene->spheres[i], &compiled->spheres[i]);
+  for (size_t j = 0; j < scene->numPlanes; j++) {
+    const PlaneGeom *plane = &scene->planes[j];
+    PrimaryPlane *compiledPlane = &compiled->planes[j];
+    real offset = 0;
+    for (int a = 0; a < 3; a++) {
+      compiledPlane->normal[a] = plane->normal[a];
+      offset += compiledPlane->normal[a] * (real)plane->position[a];
+    }
+    compiledPlane->offset = offset;
+  }
+  compiled->numSpheres = scene->numSpheres;
+  compiled->numPlanes = scene->numPlanes;
+}
+
+/**
+ * Compiles just the spheres that moved since the scene was compiled
+ *
+ * @param compiled a compiled version of the scene
+ * @param scene
+ * @param moved indices of the spheres that moved
+ * @param numMoved
+ */
+void recompileSpheres(CompiledScene *compiled, Scene *scene, const int *moved,
+                      int numMoved) {
+  for (int k = 0; k < numMoved; k++)
+    compileSphere(&scene->spheres[moved[k]], &compiled->spheres[moved[k]]);
+}
+
+void freeCompiledScene(CompiledScene *compiled) {
+  free(compiled->spheres);
+  free(compiled->planes);
+  compiled->spheres = NULL;
+  compiled->planes = NULL;
+  compiled->sphereCapacity = 0;
+  compiled->planeCapacity = 0;
+}
+
+/**
+ * sphereIntersection() for a ray from the camera with a unit direction:
+ * a = 1, and with the halved linear term no division is left
+ *
+ * @param Rd unit direction
+ * @param sphere
+ * @return the distance to the closest hit in front of the camera, or -1
+ */
+static inline real primarySphereIntersection(const real *Rd,
+                                             const PrimarySphere *sphere) {
+  real b = Rd[0] * sphere->center[0] + Rd[1] * sphere->center[1] +
+           Rd[2] * sphere->center[2];
+  real det = sqr(b) - sphere->c;
+  if (det < 0)
+    return -1;
+
+  det = sqrt(det);
+  real t0 = b - det;
+  if (t0 > 0)
+    return t0;
+
+  real t1 = b + det;
+  if (t1 > 0)
+    return t1;
+
+  return -1;
+}
+
+/**
+ * planeIntersection() for a ray from the camera
+ *
+ * @param Rd
+ * @param plane
+ * @return the distance to the hit in front of the camera, or 0
+ */
+static inline real primaryPlaneIntersection(const real *Rd,
+                                            const PrimaryPlane *plane) {
+  real t = plane->offset / (plane->normal[0] * Rd[0] +
+                            plane->normal[1] * Rd[1] + plane->normal[2] * Rd[2]);
+  if (t > 0)
+    return t;
+  return 0;
+}
+
+/**
+ * closestCandidate() for a ray from the camera
+ *
+ * @param compiled
+ * @param candidates sphere indices, in scene order
+ * @param count number of candidates
+ * @param Rd unit direction
+ * @param t set to the distance to the closest object
+ * @return the index of the closest object, or -1 if nothing is hit
+ */
+static inline int closestPrimary(const CompiledScene *compiled,
+                                 const int *candidates, int count,
+                                 const real *Rd, real *t) {
+  real max = INFINITY;
+  int hit = -1;
+
+  for (int c = 0; c < count; c++) {
+    int i = candidates[c];
+    real t = primarySphereIntersection(Rd, &compiled->spheres[i]);
+    if (t > 0 && t < max) {
+      max = t;
+      hit = i;
+    }
+  }
+  for (size_t j = 0; j < compiled->numPlanes; j++) {
+    real t = primaryPlaneIntersection(Rd, &compiled->planes[j]);
+    if (t > 0 && t < max) {
+      max = t;
+      hit = compiled->numSpheres + j;
+    }
+  }
+
+  *t = max;
+  return hit;
+}
+
+#endif
@@ -1,69 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "Animation.h"
+#include "FrameWriter.h"
 #include "PixTool.h"
 #include "JSONParser.h"
 #include "RayTracer.h"
+#include "Renderer.h"
+#include "Server.h"
 #include "VectorMath.h"
 
+static const char cli_help_text[] =
+    "raycast [width] [height] [input json] [output ppm] [--aa N] [--aa-threshold T]\n"
+    "        [--bounces N] [--wavefront] [--frames N [--stream]]\n"
+    "        [--progressive] [--budget MS]\n"
+    "raycast --serve [input json] [--socket path]\n"
+    "Description -- Renders a scene, or keeps it loaded and renders requests\n"
+    "  --bounces N reflections followed per ray (default 3)\n"
+    "  --wavefront trace in batched passes even if nothing is reflective\n"
+    "  --frames N  animate N frames; [output ppm] is a pattern like frame%04d.ppm,\n"
+    "              or with --stream one file (- for stdout) of concatenated frames\n"
+    "  --progressive  publish a coarse preview to [output ppm] first, then\n"
+    "              refine it in passes up to the final image\n"
+    "  --budget MS stop refining a progressive render (implied) when the next\n"
+    "              pass would end after MS milliseconds\n";
+
 /**
- * Finds the intersection with a plane by the formula provided in class/text
+ * Loads a scene for any of the modes, warning unless it has exactly one
+ * camera
  *
- * @param Ro
- * @param Rd
- * @param position
- * @param normal
- * @return double representing the intersection
+ * @param path the scene file
+ * @return the scene, or NULL if it holds no objects
  */
-double planeIntersection(double *Ro, double *Rd, double *position, double *normal) {
-    // distance = dot(Po-Lo,N)/dot(L,N)
-    V3 temp = malloc(sizeof(double) * 3);
-    vectorSubtract(Ro, position, temp);
-    double distance = vectorDot(normal, temp);
-
-    double denominator = vectorDot(normal, Rd);
-    distance = -(distance / denominator);
-    if (distance > 0)
-        return distance;
-
-    return 0;
+static Scene *loadSceneChecked(char *path) {
+  Scene *scene = readScene(path);
+  if (scene && scene->numCameras != 1) {
+    fprintf(stderr, "ERROR: Incorrect number of cameras specified, must have exactly 1. Found: %d\n", scene->numCameras);
+  }
+  return scene;
 }
 
 /**
- *  Finds the intersection with a sphere using the formula provided in class/text
- * @param Ro
- * @param Rd
- * @param Center
- * @param r
- * @return double representing the intersection
+ * Render server mode: loads the scene once, then answers render requests
+ * read from stdin (or a Unix socket) until "quit" or end of input
+ *
+ * @param argc
+ * @param argv
+ * @return 0 on a clean shutdown
  */
-double sphereIntersection( double *Ro, double *Rd, double *Center, double r ) {
-  double a = (sqr(Rd[0]) + sqr(Rd[1]) + sqr(Rd[2]));
-  double b = (2 * (Ro[0] * Rd[0] - Rd[0] * Center[0] + Ro[1] * Rd[1] -
-                   Rd[1] * Center[1] + Ro[2] * Rd[2] - Rd[2] * Center[2]));
-  double c = sqr(Ro[0]) - 2 * Ro[0] * Center[0] + sqr((Center[1]) + Ro[1]) -
-             2 * Ro[1] * Center[1] + sqr(Center[1]) + sqr(Ro[2]) -
-             2 * Ro[2] * Center[2] + sqr(Center[2]) - sqr(r);
-
-  double det = sqr(b) - 4 * a * c;
-  if (det < 0)
-    return -1;
+int serveMain(int argc, char *argv[]) {
+  char *socketPath = NULL;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else {
+      fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
+      exit(1);
+    }
+  }
 
-  det = sqrt(det);
+  double start = nowMs();
+  Scene *scene = loadSceneChecked(argv[2]);
+  if (!scene)
+    return 1;
+
+  RenderContext ctx;
+  initRenderContext(&ctx, scene);
+  fprintf(stderr, "Loaded %zu spheres and %zu planes in %.3f ms\n",
+          scene->numSpheres, scene->numPlanes, nowMs() - start);
+
+  int status = 0;
+  if (socketPath)
+    status = runSocketServer(&ctx, argv[2], socketPath);
+  else
+    serveRequests(&ctx, argv[2], stdin, stdout);
+
+  // reloads replace the resident scene
+  scene = ctx.scene;
+  freeRenderContext(&ctx);
+  freeScene(scene);
+  return status;
+}
 
-  double t0 = (-b - det) / (2 * a);
-  if (t0 > 0)
-    return t0;
+/**
+ * Animation mode: parses the scene once and renders frames 0 .. frames - 1,
+ * moving the spheres by their velocities between frames. Each frame only
+ * re-traces the tiles moving spheres touched, and finished frames are
+ * written by a background thread while the next one renders.
+ *
+ * @param scene the scene at frame 0
+ * @param imgWidth
+ * @param imgHeight
+ * @param options
+ * @param frames number of frames
+ * @param out numbered file pattern, or the stream file with stream set
+ * @param stream write one concatenated PPM stream instead of numbered files
+ * @return 0 if every frame was written
+ */
+int animateMain(Scene *scene, int imgWidth, int imgHeight,
+                RenderOptions *options, int frames, char *out, bool stream) {
+  FILE *streamFile = NULL;
+  if (stream) {
+    streamFile = strcmp(out, "-") == 0 ? stdout : fopen(out, "wb");
+    if (!streamFile) {
+      fprintf(stderr, "ERROR: Failed to open file %s\n", out);
+      return 1;
+    }
+  } else if (!validFramePattern(out)) {
+    fprintf(stderr, "Error: Output \"%s\" needs one frame number "
+                    "conversion like %%04d, or use --stream\n", out);
+    return 1;
+  }
 
-  double t1 = (-b + det) / (2 * a);
-  if (t1 > 0)
-    return t1;
+  double start = nowMs();
+  RenderContext ctx;
+  initRenderContext(&ctx, scene);
+  setRenderView(&ctx, scene->cameraWidth, scene->cameraHeight, imgWidth,
+                imgHeight);
+  Animation anim;
+  initAnimation(&anim, scene);
+
+  FrameWriter writer;
+  if (!openFrameWriter(&writer, imgWidth, imgHeight, stream ? NULL : out,
+                       streamFile)) {
+    if (streamFile && streamFile != stdout)
+      fclose(streamFile);
+    freeAnimation(&anim);
+    freeRenderContext(&ctx);
+    return 1;
+  }
+  double setupMs = nowMs() - start;
+
+  double renderMs = 0, stallMs = 0;
+  long tilesTraced = 0;
+  bool ok = true;
+  for (int frame = 0; frame < frames && ok; frame++) {
+    double frameStart = nowMs();
+    advanceAnimation(&ctx, &anim, frame);
+    RenderStats stats;
+    Pixel *buffer = renderFrame(&ctx, options, &stats);
+    double rendered = nowMs();
+    ok = submitFrame(&writer, buffer, frame);
+    renderMs += rendered - frameStart;
+    stallMs += nowMs() - rendered;
+    tilesTraced += stats.tilesTraced;
+  }
+  if (!closeFrameWriter(&writer))
+    ok = false;
+  double totalMs = nowMs() - start;
+
+  long numTiles = (long)ctx.grid.tilesX * ctx.grid.tilesY;
+  fprintf(stderr,
+          "Animated %d frames (%d moving spheres) in %.1f ms: setup %.1f ms, "
+          "render %.1f ms, waiting on the writer %.1f ms\n"
+          "Traced %ld of %ld tiles (%.1f%%), candidate lists rebuilt %ld "
+          "times\n",
+          frames, anim.numMoving, totalMs, setupMs, renderMs, stallMs,
+          tilesTraced, numTiles * frames,
+          100.0 * tilesTraced / (numTiles * frames), anim.listRebuilds);
+
+  if (streamFile && streamFile != stdout && fclose(streamFile) != 0)
+    ok = false;
+  freeAnimation(&anim);
+  freeRenderContext(&ctx);
+  if (!ok) {
+    fprintf(stderr, "Error: Failed to write every frame\n");
+    return 1;
+  }
+  return 0;
+}
 
-  return -1;
+/**
+ * Writes an image so that readers of path only ever see a complete file:
+ * it goes to a temporary file next to path first, which then replaces
+ * path in one rename
+ *
+ * @return false if the image could not be written
+ */
+static bool publishImage(const char *path, Pixel *buffer, int width,
+                         int height) {
+  char temp[4096];
+  if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+    fprintf(stderr, "Error: Output path too long\n");
+    return false;
+  }
+  FILE *out = fopen(temp, "wb");
+  if (!out) {
+    fprintf(stderr, "Error: Failed to open file %s\n", temp);
+    return false;
+  }
+  bufferToBinary(buffer, width, height, out);
+  if (fclose(out) != 0 || rename(temp, path) != 0) {
+    fprintf(stderr, "Error: Failed to write %s\n", path);
+    remove(temp);
+    return false;
+  }
+  return true;
 }
 
+/**
+ * Progressive mode: renders the passes of renderPass() from the coarsest
+ * to the finest and publishes every preview to the output file, so a
+ * viewer polling it always finds the best image so far. Each pass traces
+ * three times as many pixels as all before it, so with a time budget the
+ * render stops at the last pass expected to finish within it, leaving that
+ * pass's preview as the output.
+ *
+ * @param scene
+ * @param imgWidth
+ * @param imgHeight
+ * @param options
+ * @param out the output file, replaced after every pass
+ * @param budgetMs time budget in milliseconds, 0 for none
+ * @return 0 if every pass was published
+ */
+int progressiveMain(Scene *scene, int imgWidth, int imgHeight,
+                    RenderOptions *options, char *out, double budgetMs) {
+  double start = nowMs();
+  RenderContext ctx;
+  initRenderContext(&ctx, scene);
+  setRenderView(&ctx, scene->cameraWidth, scene->cameraHeight, imgWidth,
+                imgHeight);
+
+  int status = 0;
+  double renderMs = 0;
+  for (int stride = PROGRESSIVE_STRIDE; stride >= 1; stride /= 2) {
+    double passStart = nowMs();
+    RenderStats stats;
+    Pixel *buffer = renderPass(&ctx, options, stride, &stats);
+    double rendered = nowMs();
+    renderMs += rendered - passStart;
+    if (!publishImage(out, buffer, imgWidth, imgHeight)) {
+      status = 1;
+      break;
+    }
+    double elapsed = nowMs() - start;
+    fprintf(stderr,
+            "Pass 1/%d: %ld rays in %.1f ms, published %.1f ms after start\n",
+            stride, stats.primaryRays + stats.aaRays, rendered - passStart,
+            elapsed);
+
+    if (stride > 1 && budgetMs > 0 && elapsed + 3 * renderMs > budgetMs) {
+      fprintf(stderr, "Time budget of %.0f ms reached, stopping at 1/%d "
+                      "resolution\n", budgetMs, stride);
+      break;
+    }
+  }
+  freeRenderContext(&ctx);
+  return status;
+}
 
 /**
  *  Main
@@ -74,8 +264,12 @@ double sphereIntersection( double *Ro, double *Rd, double *Center, double r ) {
  */
 int main(int argc, char *argv[]) {
 
+  if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+    return serveMain(argc, argv);
+
   // check if required args are present
   if (argc < 5) {
+    printf("%s", cli_help_text);
     fprintf(stderr, "Error: Not enough arguments\n");
     exit(1);
   }
@@ -84,6 +278,88 @@ int main(int argc, char *argv[]) {
   int imgWidth = strtol(argv[1], (char **)NULL, 10);
   int imgHeight = strtol(argv[2], (char **)NULL, 10);
   char *inputJson = argv[3];
+  if (imgWidth < 1 || imgHeight < 1) {
+    fprintf(stderr, "Error: Image width and height must be at least 1\n");
+    exit(1);
+  }
+
+  // optional flags follow the required arguments
+  RenderOptions options = DEFAULT_RENDER_OPTIONS;
+  int frames = 0;
+  bool stream = false;
+  bool progressive = false;
+  double budgetMs = 0;
+  for (int i = 5; i < argc; i++) {
+    if (strcmp(argv[i], "--aa") == 0 && i + 1 < argc) {
+      options.aaSamples = strtol(argv[++i], (char **)NULL, 10);
+      if (options.aaSamples < 0 || options.aaSamples > MAX_AA_SAMPLES) {
+        fprintf(stderr, "Error: --aa must be between 0 and %d\n",
+                MAX_AA_SAMPLES);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--aa-threshold") == 0 && i + 1 < argc) {
+      options.aaThreshold = strtol(argv[++i], (char **)NULL, 10);
+      if (options.aaThreshold < 0) {
+        fprintf(stderr, "Error: --aa-threshold must not be negative\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc) {
+      options.maxBounces = strtol(argv[++i], (char **)NULL, 10);
+      if (options.maxBounces < 0) {
+        fprintf(stderr, "Error: --bounces must not be negative\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--wavefront") == 0) {
+      options.wavefront = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = strtol(argv[++i], (char **)NULL, 10);
+      if (frames < 1) {
+        fprintf(stderr, "Error: --frames must be at least 1\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      stream = true;
+    } else if (strcmp(argv[i], "--progressive") == 0) {
+      progressive = true;
+    } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+      budgetMs = strtod(argv[++i], (char **)NULL);
+      if (budgetMs <= 0) {
+        fprintf(stderr, "Error: --budget must be positive\n");
+        exit(1);
+      }
+      progressive = true;
+    } else {
+      fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  if (stream && !frames) {
+    fprintf(stderr, "Error: --stream needs --frames\n");
+    exit(1);
+  }
+  if (progressive && frames) {
+    fprintf(stderr, "Error: --progressive renders a single frame, not --frames\n");
+    exit(1);
+  }
+  if (progressive) {
+    Scene *scene = loadSceneChecked(inputJson);
+    if (!scene)
+      return 1;
+    int status = progressiveMain(scene, imgWidth, imgHeight, &options,
+                                 argv[4], budgetMs);
+    freeScene(scene);
+    return status;
+  }
+  if (frames) {
+    Scene *scene = loadSceneChecked(inputJson);
+    if (!scene)
+      return 1;
+    int status = animateMain(scene, imgWidth, imgHeight, &options, frames,
+                             argv[4], stream);
+    freeScene(scene);
+    return status;
+  }
 
   // open the output file
   FILE *outputPPM = fopen(argv[4], "wb");
@@ -93,97 +369,45 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  // define/init colored pixel objects
-  Pixel color = {.r = 0, .g = 0, .b = 0};
-  Pixel black = {.r = 0, .g = 0, .b = 0};
-
-  // populate the array of object pointers using readScene
-  Object **objects = readScene(inputJson);
-
-  double h = 2;
-  double w = 2;
-  int num_cams = 0;
-
-  // discover the camera and read its values
-  for (int i = 0; objects[i] != 0; i++) {
-    if (objects[i]->type == 0) {
-      w = objects[i]->Camera.width;
-      h = objects[i]->Camera.height;
-      num_cams++;
-    }
-  }
-
-  // ensure 1 and only 1 camera
-  if ( num_cams != 1 ) {
-    fprintf( stderr, "ERROR: Incorrect number of cameras specified, must have exactly 1. Found: %d\n", num_cams );
+  // populate the packed scene arrays using readScene
+  Scene *scene = loadSceneChecked(inputJson);
+  if (!scene) {
+    fclose(outputPPM);
+    return 1;
   }
 
-  double cx = 0;
-  double cy = 0;
-
   int M = imgWidth;
   int N = imgHeight;
 
-  Pixel *buffer = malloc(M * N * sizeof(Pixel));
-
-  double pixheight = h / M;
-  double pixwidth = w / N;
-
-  for (int y = 0; y < M; y += 1) {
-      for (int x = 0; x < N; x += 1) {
-          double Ro[3] = {0, 0, 0};
-          // Rd = normalize(P - Ro)
-          double Rd[3] = {cx - (w / 2) + pixwidth * (x + 0.5),
-                          -(cy - (h / 2) + pixheight * (y + 0.5)), 1};
-          normalize(Rd);
-
-          double max = INFINITY;
-          bool shape_detected = false;
-          for (int i = 0; objects[i] != 0; i++) {
-              if (shape_detected)
-                  break;
-
-              double t = 0;
-              switch (objects[i]->type) {
-
-                  // Case when encountering a PLANE
-                  case 2:
-                      t = planeIntersection(Ro, Rd, objects[i]->Plane.position, objects[i]->Plane.normal);
-                      if (t > 0 && t < max) {
-                          shape_detected = true;
-                          color = objects[i]->color;
-                      }
-                      break;
-
-                      // Case when encountering a SPHERE
-                  case 1:
-                      t = sphereIntersection(Ro, Rd, objects[i]->Sphere.position, objects[i]->Sphere.radius);
-                      if (t > 0 && t < max) {
-                          shape_detected = true;
-                          color = objects[i]->color;
-                      }
-                      break;
-
-                      // Case when encountering the CAMERA
-                  case 0:
-                      break;
-
-                  default: // switch should never default out (error)
-                      exit(1);
-              }
-
-              if (t > 0 && t < max)
-                  max = t;
-
-              if (max > 0 && max != INFINITY) {
-                  buffer[y * M + x] = color;
-              } else {
-                  buffer[y * M + x] = black;
-              }
-          }
-      }
+  RenderContext ctx;
+  initRenderContext(&ctx, scene);
+  setRenderView(&ctx, scene->cameraWidth, scene->cameraHeight, M, N);
+
+  RenderStats stats;
+  Pixel *buffer = renderFrame(&ctx, &options, &stats);
+  if (options.aaSamples > 1) {
+    fprintf(stderr, "Adaptive AA: refined %ld of %ld pixels (%.1f%%), %ld extra rays\n",
+            stats.refinedPixels, stats.primaryRays,
+            100.0 * stats.refinedPixels / stats.primaryRays, stats.aaRays);
   }
+  if (scene->numLights) {
+    fprintf(stderr,
+            "Lighting: %.1f ms tracing, %.1f ms shading including %ld shadow "
+            "rays, %.2f tests per shadow ray, %.1f%% occluded, %ld answered "
+            "by the occluder cache\n",
+            stats.traceMs, stats.shadeMs, stats.shadow.rays,
+            stats.shadow.rays ? (double)stats.shadow.tests / stats.shadow.rays : 0,
+            stats.shadow.rays ? 100.0 * stats.shadow.occluded / stats.shadow.rays : 0,
+            stats.shadow.cacheHits);
+  }
+  if (stats.secondaryRays) {
+    fprintf(stderr,
+            "Reflections: %ld secondary rays, %.1f ms tracing, %.1f ms shading\n",
+            stats.secondaryRays, stats.traceMs, stats.shadeMs);
+  }
+
     //write the resultant scene to file as a PPM image (this could be a frame in another context)
     bufferToBinary(buffer, M, N, outputPPM);
+    fclose(outputPPM);
     return 0;
 }
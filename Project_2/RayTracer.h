@@ -2,30 +2,54 @@
 #define _TRACER_H_
 
 #include "PixTool.h"
+#include "VectorMath.h"
 
 const uint8_t CAMERA = 0;
 const uint8_t SPHERE = 1;
 const uint8_t PLANE = 2;
+const uint8_t LIGHT = 3;
 
 typedef struct {
   int type;
+  // the diffuse color of spheres and planes
   Pixel color;
+  // highlight color and exponent of spheres and planes, used when the scene
+  // has lights
+  Pixel specularColor;
+  real shininess;
+  // share of the color a mirror bounce contributes, 0 to 1
+  real reflectivity;
 
   union {
     struct {
-      double width;
-      double height;
+      real width;
+      real height;
     } Camera;
 
     struct {
-      double position[3];
-      double radius;
+      real position[3];
+      real radius;
+      // distance moved per animation frame
+      real velocity[3];
     } Sphere;
 
     struct {
-      double normal[3];
-      double position[3];
+      real normal[3];
+      real position[3];
     } Plane;
+
+    struct {
+      real position[3];
+      // intensity per channel, 1 passes a surface color unchanged
+      real color[3];
+      // a spot light when theta (the cutoff half-angle in degrees) is set
+      real direction[3];
+      real theta;
+      // attenuation 1 / (a0 + a1 d + a2 d^2) over distance d
+      real radial[3];
+      // falloff exponent inside a spot light's cone
+      real angular0;
+    } Light;
   };
 
 } Object;
@@ -0,0 +1,787 @@
+#ifndef _RENDERER_H_
+#define _RENDERER_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Camera.h"
+#include "Clock.h"
+#include "Intersect.h"
+#include "Lighting.h"
+#include "PixTool.h"
+#include "PrimaryRays.h"
+#include "RayTracer.h"
+#include "Scene.h"
+#include "Tiles.h"
+#include "VectorMath.h"
+#include "Wavefront.h"
+#include "WorldGrid.h"
+
+/**
+ * Largest number of anti-aliasing samples per axis a render accepts
+ */
+#define MAX_AA_SAMPLES 16
+
+/**
+ * Options controlling how a frame is rendered
+ */
+typedef struct {
+  // stratified samples per axis for pixels refined by adaptive
+  // anti-aliasing, 0 or 1 disables it, at most MAX_AA_SAMPLES
+  int aaSamples;
+  // largest per-channel difference to a neighbour that is not treated as an
+  // edge
+  int aaThreshold;
+  // reflections followed per path
+  int maxBounces;
+  // trace in batched passes (see Wavefront.h) even without reflections,
+  // which always use them
+  bool wavefront;
+} RenderOptions;
+
+const RenderOptions DEFAULT_RENDER_OPTIONS = {
+    .aaSamples = 0, .aaThreshold = 16, .maxBounces = 3, .wavefront = false};
+
+/**
+ * True if two sets of options render the same image
+ */
+static bool sameRenderOptions(const RenderOptions *a, const RenderOptions *b) {
+  return a->aaSamples == b->aaSamples && a->aaThreshold == b->aaThreshold &&
+         a->maxBounces == b->maxBounces && a->wavefront == b->wavefront;
+}
+
+/**
+ * Counters filled in by a render
+ */
+typedef struct {
+  long primaryRays;
+  long aaRays;
+  long refinedPixels;
+  // ray-object intersection tests after tile culling
+  long intersectionTests;
+  // tiles whose primary rays were traced, fewer than all of them when a
+  // frame is updated incrementally
+  long tilesTraced;
+  // reflection rays, traced by the wavefront passes
+  long secondaryRays;
+  ShadowStats shadow;
+  // time spent finding the closest hits of all rays, and shading them
+  // (which includes the shadow rays)
+  double traceMs;
+  double shadeMs;
+} RenderStats;
+
+/**
+ * Cheap integer hash used to jitter samples inside their strata, so the
+ * result is the same on every run
+ */
+static inline double sampleJitter(uint32_t x, uint32_t y, uint32_t s) {
+  uint32_t v = x * 73856093u ^ y * 19349663u ^ s * 83492791u;
+  v ^= v >> 16;
+  v *= 0x7feb352du;
+  v ^= v >> 15;
+  v *= 0x846ca68bu;
+  v ^= v >> 16;
+  return (v >> 8) / 16777216.0;
+}
+
+/**
+ * True if the two colors differ by more than the threshold in any channel
+ */
+static inline bool colorDiffers(Pixel a, Pixel b, int threshold) {
+  return abs(a.r - b.r) > threshold || abs(a.g - b.g) > threshold ||
+         abs(a.b - b.b) > threshold;
+}
+
+/**
+ * Decides whether a pixel sits on an edge: any 4-neighbour hit a different
+ * object or has a color beyond the threshold
+ */
+static bool isEdgePixel(Pixel *buffer, int *hits, int imgWidth, int imgHeight,
+                        int x, int y, int threshold) {
+  int i = y * imgWidth + x;
+  int neighbours[4][2] = {{x - 1, y}, {x + 1, y}, {x, y - 1}, {x, y + 1}};
+  for (int n = 0; n < 4; n++) {
+    int nx = neighbours[n][0];
+    int ny = neighbours[n][1];
+    if (nx < 0 || ny < 0 || nx >= imgWidth || ny >= imgHeight)
+      continue;
+    int j = ny * imgWidth + nx;
+    if (hits[i] != hits[j] || colorDiffers(buffer[i], buffer[j], threshold))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Everything a render needs besides the scene, kept between frames so that
+ * repeated renders of a resident scene (the render server, benchmark
+ * repeats) reuse the acceleration data and buffers instead of rebuilding
+ * them.
+ *
+ * The tile grid doubles as the record of which primitives each tile's rays
+ * can touch, and the previous frame is kept next to it: after a scene edit
+ * (see SceneDiff.h) only the tiles flagged dirty are traced again.
+ */
+typedef struct {
+  Scene *scene;
+
+  // the view of the next frame and the tile grid built for it
+  View view;
+  bool gridValid;
+  TileGrid grid;
+
+  // per-frame buffers, grown as needed and reused between frames: the
+  // primary ray colors and hits, the final (anti-aliased) frame and the
+  // edge pixels the wavefront anti-aliasing pass refines
+  size_t pixelCapacity;
+  Pixel *primary;
+  int *hits;
+  Pixel *buffer;
+  int *edges;
+
+  // the previous frame, still valid for the current view, was rendered
+  // with frameOptions; only tiles flagged in dirty need tracing again
+  bool frameValid;
+  RenderOptions frameOptions;
+  uint8_t *dirty;
+  // stride of the last pass of an unfinished progressive render, 0 if none
+  int passStride;
+
+  // one direction grid per light of the scene, and per tile the last
+  // occluder found for each light
+  bool lightsValid;
+  size_t numLightGrids;
+  LightGrid *lightGrids;
+  size_t numOccluders;
+  int *occluders;
+
+  // the scene compiled for primary rays, see PrimaryRays.h
+  bool sceneCompiled;
+  CompiledScene compiled;
+
+  // for rays that do not leave the camera, and the queues that carry them
+  bool worldValid;
+  WorldGrid world;
+  Wavefront wavefront;
+} RenderContext;
+
+/**
+ * Prepares a context for rendering the given scene
+ *
+ * @param ctx
+ * @param scene the scene, owned by the caller and kept resident
+ */
+void initRenderContext(RenderContext *ctx, Scene *scene) {
+  memset(ctx, 0, sizeof(RenderContext));
+  ctx->scene = scene;
+}
+
+/**
+ * Forgets the acceleration data and the previous frame, needed after the
+ * view or the scene changed in a way that cannot be tracked per tile
+ */
+void invalidateRenderContext(RenderContext *ctx) {
+  if (ctx->gridValid)
+    freeTileGrid(&ctx->grid);
+  ctx->gridValid = false;
+  ctx->frameValid = false;
+  ctx->passStride = 0;
+}
+
+/**
+ * Drops the light grids, the world grid and the compiled scene, needed
+ * when the scene is replaced; moved spheres are refit instead, see
+ * refitSceneGrids()
+ */
+void invalidateSceneGrids(RenderContext *ctx) {
+  for (size_t l = 0; l < ctx->numLightGrids; l++)
+    freeLightGrid(&ctx->lightGrids[l]);
+  free(ctx->lightGrids);
+  ctx->lightGrids = NULL;
+  ctx->numLightGrids = 0;
+  ctx->lightsValid = false;
+  if (ctx->worldValid)
+    freeWorldGrid(&ctx->world);
+  ctx->worldValid = false;
+  ctx->sceneCompiled = false;
+}
+
+/**
+ * Brings the light grids, the world grid and the compiled scene up to date
+ * after some spheres moved. They are refit, re-binning just those spheres,
+ * the way advanceAnimation() refits the tile grid.
+ *
+ * @param ctx
+ * @param moved indices of the spheres that moved
+ * @param numMoved
+ */
+void refitSceneGrids(RenderContext *ctx, const int *moved, int numMoved) {
+  Scene *scene = ctx->scene;
+  if (ctx->lightsValid)
+    for (size_t l = 0; l < ctx->numLightGrids; l++)
+      refitLightGrid(&ctx->lightGrids[l], scene, &scene->lights[l], moved,
+                     numMoved);
+  if (ctx->worldValid)
+    refitWorldGrid(&ctx->world, scene, moved, numMoved);
+  if (ctx->sceneCompiled)
+    recompileSpheres(&ctx->compiled, scene, moved, numMoved);
+}
+
+void freeRenderContext(RenderContext *ctx) {
+  invalidateRenderContext(ctx);
+  invalidateSceneGrids(ctx);
+  freeWavefront(&ctx->wavefront);
+  freeCompiledScene(&ctx->compiled);
+  free(ctx->occluders);
+  free(ctx->primary);
+  free(ctx->hits);
+  free(ctx->buffer);
+  free(ctx->edges);
+  free(ctx->dirty);
+  memset(ctx, 0, sizeof(RenderContext));
+}
+
+/**
+ * Bins the context's scene into tiles for the current view
+ */
+void rebuildTileGrid(RenderContext *ctx) {
+  if (ctx->gridValid)
+    freeTileGrid(&ctx->grid);
+  buildTileGrid(&ctx->grid, ctx->scene, &ctx->view);
+  ctx->gridValid = true;
+}
+
+/**
+ * Sets the camera and image size of the next frame. The tile grid is only
+ * rebuilt and the buffers only grown when they no longer fit.
+ *
+ * @param ctx
+ * @param w camera width
+ * @param h camera height
+ * @param imgWidth image width in pixels, at least 1
+ * @param imgHeight image height in pixels, at least 1
+ * @return true if the tile grid had to be rebuilt
+ */
+bool setRenderView(RenderContext *ctx, real w, real h, int imgWidth,
+                   int imgHeight) {
+  View view = makeView(w, h, imgWidth, imgHeight);
+  if (ctx->gridValid && (view.w != ctx->view.w || view.h != ctx->view.h ||
+                         view.imgWidth != ctx->view.imgWidth ||
+                         view.imgHeight != ctx->view.imgHeight))
+    invalidateRenderContext(ctx);
+  ctx->view = view;
+  bool rebuilt = !ctx->gridValid;
+  if (rebuilt) {
+    rebuildTileGrid(ctx);
+    ctx->dirty = realloc(ctx->dirty, ctx->grid.tilesX * ctx->grid.tilesY);
+  }
+
+  size_t numPixels = (size_t)imgWidth * imgHeight;
+  if (numPixels > ctx->pixelCapacity) {
+    ctx->pixelCapacity = numPixels;
+    ctx->primary = realloc(ctx->primary, sizeof(Pixel) * numPixels);
+    ctx->hits = realloc(ctx->hits, sizeof(int) * numPixels);
+    ctx->buffer = realloc(ctx->buffer, sizeof(Pixel) * numPixels);
+    ctx->edges = realloc(ctx->edges, sizeof(int) * numPixels);
+    if (!ctx->primary || !ctx->hits || !ctx->buffer || !ctx->edges ||
+        !ctx->dirty) {
+      fprintf(stderr, "Error: Out of memory for a %dx%d frame\n", imgWidth,
+              imgHeight);
+      exit(1);
+    }
+  }
+  return rebuilt;
+}
+
+/**
+ * Bins the scene's spheres around each light and resets the occluder
+ * caches, unless that is still current
+ */
+static void prepareLights(RenderContext *ctx) {
+  Scene *scene = ctx->scene;
+  if (!ctx->lightsValid) {
+    for (size_t l = 0; l < ctx->numLightGrids; l++)
+      freeLightGrid(&ctx->lightGrids[l]);
+    free(ctx->lightGrids);
+    ctx->lightGrids = malloc(sizeof(LightGrid) * (scene->numLights + 1));
+    for (size_t l = 0; l < scene->numLights; l++)
+      buildLightGrid(&ctx->lightGrids[l], scene, &scene->lights[l]);
+    ctx->numLightGrids = scene->numLights;
+    ctx->lightsValid = true;
+    // cached occluders may no longer exist
+    ctx->numOccluders = 0;
+  }
+
+  size_t needed = (size_t)ctx->grid.tilesX * ctx->grid.tilesY * scene->numLights;
+  if (needed != ctx->numOccluders) {
+    ctx->occluders = realloc(ctx->occluders, sizeof(int) * (needed + 1));
+    for (size_t i = 0; i < needed; i++)
+      ctx->occluders[i] = -1;
+    ctx->numOccluders = needed;
+  }
+}
+
+/**
+ * True if a pixel was traced by a previous progressive pass, whose stride
+ * was coarser (0 if there was none)
+ */
+static inline bool tracedBefore(int x, int y, int coarser) {
+  return coarser && x % coarser == 0 && y % coarser == 0;
+}
+
+/**
+ * Traces the primary ray through the center of every pixel of a tile, or
+ * of just the pixels of one progressive pass: every stride-th pixel in
+ * both directions that no coarser pass traced (stride 1 and coarser 0 for
+ * all of them). The closest hits are found for the whole tile first and
+ * shaded after, which keeps each loop tight and times the two apart.
+ */
+static void traceTile(RenderContext *ctx, int tx, int ty, int stride,
+                      int coarser, RenderStats *counts) {
+  Scene *scene = ctx->scene;
+  TileGrid *grid = &ctx->grid;
+  int imgWidth = ctx->view.imgWidth;
+  int imgHeight = ctx->view.imgHeight;
+
+  int tile = ty * grid->tilesX + tx;
+  int *candidates = &grid->indices[grid->offsets[tile]];
+  int count = grid->offsets[tile + 1] - grid->offsets[tile];
+  int *occluders = &ctx->occluders[tile * scene->numLights];
+
+  int yEnd = (ty + 1) * TILE_SIZE < imgHeight ? (ty + 1) * TILE_SIZE : imgHeight;
+  int xEnd = (tx + 1) * TILE_SIZE < imgWidth ? (tx + 1) * TILE_SIZE : imgWidth;
+  real distances[TILE_SIZE * TILE_SIZE];
+  real Ro[3] = {0, 0, 0};
+
+  // tiles start on every pass's lattice, strides divide TILE_SIZE
+  long pixels = 0;
+  double start = nowMs();
+  for (int y = ty * TILE_SIZE; y < yEnd; y += stride) {
+    for (int x = tx * TILE_SIZE; x < xEnd; x += stride) {
+      if (tracedBefore(x, y, coarser))
+        continue;
+      real Rd[3];
+      primaryRay(&ctx->view, x + 0.5, y + 0.5, Rd);
+      pixels++;
+
+      // the hit index is kept to find edges between neighbours
+      ctx->hits[y * imgWidth + x] =
+          closestPrimary(&ctx->compiled, candidates, count, Rd,
+                         &distances[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE]);
+    }
+  }
+  double traced = nowMs();
+
+  for (int y = ty * TILE_SIZE; y < yEnd; y += stride) {
+    for (int x = tx * TILE_SIZE; x < xEnd; x += stride) {
+      if (tracedBefore(x, y, coarser))
+        continue;
+      int i = y * imgWidth + x;
+      if (!scene->numLights) {
+        // flat shading needs neither the ray nor the hit point
+        Pixel black = {.r = 0, .g = 0, .b = 0};
+        ctx->primary[i] = ctx->hits[i] < 0 ? black : sceneColor(scene, ctx->hits[i]);
+        continue;
+      }
+      real Rd[3];
+      primaryRay(&ctx->view, x + 0.5, y + 0.5, Rd);
+      ctx->primary[i] = shadeHit(
+          scene, ctx->lightGrids, ctx->hits[i],
+          distances[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE], Ro, Rd,
+          occluders, &counts->shadow);
+    }
+  }
+  counts->traceMs += traced - start;
+  counts->shadeMs += nowMs() - traced;
+
+  counts->primaryRays += pixels;
+  counts->intersectionTests += (count + scene->numPlanes) * pixels;
+  counts->tilesTraced++;
+}
+
+/**
+ * Traces samples x samples jittered, stratified rays through one pixel and
+ * returns their average color. Like traceTile(), all closest hits are
+ * found before any is shaded, so the clock is read once per phase rather
+ * than per sample.
+ */
+static Pixel supersamplePixel(RenderContext *ctx, int tile, int x, int y,
+                              int samples, RenderStats *counts) {
+  Scene *scene = ctx->scene;
+  TileGrid *grid = &ctx->grid;
+  int *candidates = &grid->indices[grid->offsets[tile]];
+  int count = grid->offsets[tile + 1] - grid->offsets[tile];
+  int n = samples * samples;
+
+  real directions[MAX_AA_SAMPLES * MAX_AA_SAMPLES][3];
+  real distances[MAX_AA_SAMPLES * MAX_AA_SAMPLES];
+  int hits[MAX_AA_SAMPLES * MAX_AA_SAMPLES];
+  double start = nowMs();
+  for (int sy = 0; sy < samples; sy++) {
+    for (int sx = 0; sx < samples; sx++) {
+      int s = sy * samples + sx;
+      primaryRay(&ctx->view, x + (sx + sampleJitter(x, y, 2 * s)) / samples,
+                 y + (sy + sampleJitter(x, y, 2 * s + 1)) / samples,
+                 directions[s]);
+      hits[s] = closestPrimary(&ctx->compiled, candidates, count,
+                               directions[s], &distances[s]);
+    }
+  }
+  double traced = nowMs();
+
+  real Ro[3] = {0, 0, 0};
+  double sum[3] = {0, 0, 0};
+  for (int s = 0; s < n; s++) {
+    Pixel c = shadeHit(scene, ctx->lightGrids, hits[s], distances[s], Ro,
+                       directions[s], &ctx->occluders[tile * scene->numLights],
+                       &counts->shadow);
+    sum[0] += c.r;
+    sum[1] += c.g;
+    sum[2] += c.b;
+  }
+  counts->traceMs += traced - start;
+  counts->shadeMs += nowMs() - traced;
+
+  Pixel avg = {.r = (uint8_t)(sum[0] / n + 0.5),
+               .g = (uint8_t)(sum[1] / n + 0.5),
+               .b = (uint8_t)(sum[2] / n + 0.5)};
+  return avg;
+}
+
+/**
+ * Computes the final color of a pixel from the primary pass: supersampled
+ * if adaptive anti-aliasing finds an edge there, the primary color
+ * otherwise
+ */
+static void resolvePixel(RenderContext *ctx, int x, int y,
+                         const RenderOptions *options, RenderStats *counts) {
+  int imgWidth = ctx->view.imgWidth;
+  int i = y * imgWidth + x;
+  if (options->aaSamples < 2 ||
+      !isEdgePixel(ctx->primary, ctx->hits, imgWidth, ctx->view.imgHeight, x,
+                   y, options->aaThreshold)) {
+    ctx->buffer[i] = ctx->primary[i];
+    return;
+  }
+
+  TileGrid *grid = &ctx->grid;
+  int tile = (y / TILE_SIZE) * grid->tilesX + x / TILE_SIZE;
+  int count = grid->offsets[tile + 1] - grid->offsets[tile];
+  ctx->buffer[i] = supersamplePixel(ctx, tile, x, y, options->aaSamples, counts);
+
+  long samples = options->aaSamples * options->aaSamples;
+  counts->refinedPixels++;
+  counts->aaRays += samples;
+  counts->intersectionTests += (count + ctx->scene->numPlanes) * samples;
+}
+
+/**
+ * True if the pixel's own tile or the tile of any 4-neighbour is dirty, in
+ * which case its anti-aliasing decision may have changed
+ */
+static bool nearDirtyTile(RenderContext *ctx, int x, int y) {
+  int tilesX = ctx->grid.tilesX;
+  int maxX = ctx->view.imgWidth - 1;
+  int maxY = ctx->view.imgHeight - 1;
+  int xs[3] = {x, x > 0 ? x - 1 : x, x < maxX ? x + 1 : x};
+  int ys[3] = {y, y > 0 ? y - 1 : y, y < maxY ? y + 1 : y};
+  for (int n = 0; n < 3; n++) {
+    if (ctx->dirty[(y / TILE_SIZE) * tilesX + xs[n] / TILE_SIZE] ||
+        ctx->dirty[(ys[n] / TILE_SIZE) * tilesX + x / TILE_SIZE])
+      return true;
+  }
+  return false;
+}
+
+static void addWavefrontStats(RenderStats *counts, const WavefrontStats *stats) {
+  counts->secondaryRays += stats->secondaryRays;
+  counts->intersectionTests += stats->intersectionTests;
+  counts->traceMs += stats->traceMs;
+  counts->shadeMs += stats->shadeMs;
+}
+
+/**
+ * Wavefront version of the primary pass: the rays of the pass in all dirty
+ * tiles are queued and traced together through traceWavefront(). Without
+ * reflections the result is byte-identical to the tile by tile path.
+ */
+static void wavefrontPrimary(RenderContext *ctx, const RenderOptions *options,
+                             int stride, int coarser, RenderStats *counts) {
+  Scene *scene = ctx->scene;
+  TileGrid *grid = &ctx->grid;
+  Wavefront *wf = &ctx->wavefront;
+  int imgWidth = ctx->view.imgWidth;
+  int imgHeight = ctx->view.imgHeight;
+  if (!ctx->worldValid) {
+    buildWorldGrid(&ctx->world, scene);
+    ctx->worldValid = true;
+  }
+  WavefrontStats stats = {0};
+  real Ro[3] = {0, 0, 0};
+
+  // one path per traced pixel, slot = pixel index
+  beginWavefront(wf, (size_t)imgWidth * imgHeight);
+  for (int ty = 0; ty < grid->tilesY; ty++) {
+    for (int tx = 0; tx < grid->tilesX; tx++) {
+      int tile = ty * grid->tilesX + tx;
+      if (!ctx->dirty[tile])
+        continue;
+      int yEnd = (ty + 1) * TILE_SIZE < imgHeight ? (ty + 1) * TILE_SIZE : imgHeight;
+      int xEnd = (tx + 1) * TILE_SIZE < imgWidth ? (tx + 1) * TILE_SIZE : imgWidth;
+      for (int y = ty * TILE_SIZE; y < yEnd; y += stride) {
+        for (int x = tx * TILE_SIZE; x < xEnd; x += stride) {
+          if (tracedBefore(x, y, coarser))
+            continue;
+          real Rd[3];
+          primaryRay(&ctx->view, x + 0.5, y + 0.5, Rd);
+          pushRay(&wf->queues[0], Ro, Rd, 1, y * imgWidth + x, tile);
+        }
+      }
+      counts->tilesTraced++;
+    }
+  }
+  counts->primaryRays += wf->queues[0].count;
+  traceWavefront(wf, scene, &ctx->compiled, grid, &ctx->world, ctx->lightGrids,
+                 ctx->occluders, options->maxBounces, ctx->hits, &stats,
+                 &counts->shadow);
+
+  for (int ty = 0; ty < grid->tilesY; ty++) {
+    for (int tx = 0; tx < grid->tilesX; tx++) {
+      if (!ctx->dirty[ty * grid->tilesX + tx])
+        continue;
+      int yEnd = (ty + 1) * TILE_SIZE < imgHeight ? (ty + 1) * TILE_SIZE : imgHeight;
+      int xEnd = (tx + 1) * TILE_SIZE < imgWidth ? (tx + 1) * TILE_SIZE : imgWidth;
+      for (int y = ty * TILE_SIZE; y < yEnd; y += stride)
+        for (int x = tx * TILE_SIZE; x < xEnd; x += stride)
+          if (!tracedBefore(x, y, coarser))
+            ctx->primary[y * imgWidth + x] = wavefrontColor(wf, y * imgWidth + x);
+    }
+  }
+  addWavefrontStats(counts, &stats);
+}
+
+/**
+ * Wavefront version of the anti-aliasing pass: the samples of every pixel
+ * on an edge are queued and traced together, then averaged like
+ * supersamplePixel() does
+ */
+static void wavefrontResolve(RenderContext *ctx, const RenderOptions *options,
+                             RenderStats *counts) {
+  Scene *scene = ctx->scene;
+  TileGrid *grid = &ctx->grid;
+  Wavefront *wf = &ctx->wavefront;
+  int imgWidth = ctx->view.imgWidth;
+  int imgHeight = ctx->view.imgHeight;
+  WavefrontStats stats = {0};
+  real Ro[3] = {0, 0, 0};
+
+  // pixels on edges get samples x samples paths each
+  int samples = options->aaSamples;
+  int *edges = ctx->edges;
+  size_t numEdges = 0;
+  for (int y = 0; y < imgHeight; y++) {
+    for (int x = 0; x < imgWidth; x++) {
+      if (!nearDirtyTile(ctx, x, y))
+        continue;
+      int i = y * imgWidth + x;
+      if (samples < 2 || !isEdgePixel(ctx->primary, ctx->hits, imgWidth,
+                                      imgHeight, x, y, options->aaThreshold))
+        ctx->buffer[i] = ctx->primary[i];
+      else
+        edges[numEdges++] = i;
+    }
+  }
+
+  if (numEdges) {
+    int perPixel = samples * samples;
+    beginWavefront(wf, numEdges * perPixel);
+    for (size_t e = 0; e < numEdges; e++) {
+      int x = edges[e] % imgWidth, y = edges[e] / imgWidth;
+      int tile = (y / TILE_SIZE) * grid->tilesX + x / TILE_SIZE;
+      for (int sy = 0; sy < samples; sy++) {
+        for (int sx = 0; sx < samples; sx++) {
+          int s = sy * samples + sx;
+          real Rd[3];
+          primaryRay(&ctx->view, x + (sx + sampleJitter(x, y, 2 * s)) / samples,
+                     y + (sy + sampleJitter(x, y, 2 * s + 1)) / samples, Rd);
+          pushRay(&wf->queues[0], Ro, Rd, 1, e * perPixel + s, tile);
+        }
+      }
+    }
+    traceWavefront(wf, scene, &ctx->compiled, grid, &ctx->world,
+                   ctx->lightGrids, ctx->occluders, options->maxBounces, NULL,
+                   &stats, &counts->shadow);
+
+    // averaged like supersamplePixel(), sample by sample
+    for (size_t e = 0; e < numEdges; e++) {
+      double sum[3] = {0, 0, 0};
+      for (int s = 0; s < perPixel; s++) {
+        Pixel c = wavefrontColor(wf, e * perPixel + s);
+        sum[0] += c.r;
+        sum[1] += c.g;
+        sum[2] += c.b;
+      }
+      Pixel avg = {.r = (uint8_t)(sum[0] / perPixel + 0.5),
+                   .g = (uint8_t)(sum[1] / perPixel + 0.5),
+                   .b = (uint8_t)(sum[2] / perPixel + 0.5)};
+      ctx->buffer[edges[e]] = avg;
+    }
+    counts->refinedPixels += numEdges;
+    counts->aaRays += numEdges * perPixel;
+  }
+  addWavefrontStats(counts, &stats);
+}
+
+/**
+ * Readies the per-scene data a frame needs and flags every tile dirty
+ * unless the previous frame can be updated
+ */
+static void prepareFrame(RenderContext *ctx, const RenderOptions *options) {
+  prepareLights(ctx);
+  if (!ctx->sceneCompiled) {
+    compileScene(&ctx->compiled, ctx->scene);
+    ctx->sceneCompiled = true;
+  }
+  if (!ctx->frameValid || !sameRenderOptions(&ctx->frameOptions, options))
+    memset(ctx->dirty, 1, ctx->grid.tilesX * ctx->grid.tilesY);
+}
+
+/**
+ * Traces the primary rays of one pass (see traceTile()) in the dirty tiles
+ * into the primary colors and hits. Scenes with reflective objects, or
+ * options asking for it, are traced by the wavefront passes instead of
+ * tile by tile.
+ */
+static void tracePrimary(RenderContext *ctx, const RenderOptions *options,
+                         int stride, int coarser, RenderStats *counts) {
+  TileGrid *grid = &ctx->grid;
+  if (options->wavefront || ctx->scene->reflective) {
+    wavefrontPrimary(ctx, options, stride, coarser, counts);
+    return;
+  }
+  for (int ty = 0; ty < grid->tilesY; ty++)
+    for (int tx = 0; tx < grid->tilesX; tx++)
+      if (ctx->dirty[ty * grid->tilesX + tx])
+        traceTile(ctx, tx, ty, stride, coarser, counts);
+}
+
+/**
+ * Turns the primary colors into the final frame, supersampling edges, and
+ * records the frame as valid
+ */
+static void resolveFrame(RenderContext *ctx, const RenderOptions *options,
+                         RenderStats *counts) {
+  if (options->wavefront || ctx->scene->reflective) {
+    wavefrontResolve(ctx, options, counts);
+  } else {
+    // edges are found on the primary colors, so every pixel sees its
+    // neighbours' primary result whatever order they are resolved in
+    for (int y = 0; y < ctx->view.imgHeight; y++)
+      for (int x = 0; x < ctx->view.imgWidth; x++)
+        if (nearDirtyTile(ctx, x, y))
+          resolvePixel(ctx, x, y, options, counts);
+  }
+
+  memset(ctx->dirty, 0, ctx->grid.tilesX * ctx->grid.tilesY);
+  ctx->frameValid = true;
+  ctx->frameOptions = *options;
+  ctx->passStride = 0;
+}
+
+/**
+ * Casts one primary ray per pixel into the scene and stores the shaded
+ * color of the closest object hit (or black) in the context's buffer, see
+ * shadeHit(). The objects are binned into screen tiles by setRenderView()
+ * so each ray only tests the objects that can cover its tile. With
+ * adaptive anti-aliasing enabled a second pass supersamples only the
+ * pixels on edges. Scenes with reflective objects, or options asking for
+ * it, are traced by the wavefront passes instead of tile by tile.
+ *
+ * When the previous frame is still valid for this view and these options,
+ * only the tiles flagged dirty by a scene update are traced again (plus the
+ * one pixel border whose anti-aliasing depends on them); the result is
+ * byte-identical to a full render.
+ *
+ * @param ctx a context whose view has been set with setRenderView()
+ * @param options render options, NULL for the defaults
+ * @param stats filled in with ray counts, may be NULL
+ * @return the frame, owned by the context and valid until its next render
+ */
+Pixel *renderFrame(RenderContext *ctx, const RenderOptions *options,
+                   RenderStats *stats) {
+  if (!options)
+    options = &DEFAULT_RENDER_OPTIONS;
+  RenderStats counts = {0};
+
+  prepareFrame(ctx, options);
+  tracePrimary(ctx, options, 1, 0, &counts);
+  resolveFrame(ctx, options, &counts);
+
+  if (stats)
+    *stats = counts;
+  return ctx->buffer;
+}
+
+/**
+ * Stride of the first pass of a progressive render, which traces one
+ * pixel in PROGRESSIVE_STRIDE^2
+ */
+#define PROGRESSIVE_STRIDE 8
+
+/**
+ * Renders one pass of a progressive render. The passes of a frame halve
+ * the stride from PROGRESSIVE_STRIDE down to 1. Each traces every
+ * stride-th pixel in both directions that the passes before did not, so
+ * each pass traces three times as many pixels as all earlier ones
+ * together. A pass with a stride larger than 1 fills the frame with a
+ * preview, repeating every traced pixel over the stride x stride block it
+ * starts. The pass with stride 1 anti-aliases like renderFrame(), and the
+ * final frame is byte-identical to it.
+ *
+ * Starting over with a stride not below the last pass's begins a new
+ * frame, which is always rendered whole.
+ *
+ * @param ctx a context whose view has been set with setRenderView()
+ * @param options render options, NULL for the defaults, the same for all
+ * passes of a frame
+ * @param stride a power of two, at most TILE_SIZE
+ * @param stats filled in with the ray counts of this pass, may be NULL
+ * @return the preview or the final frame, owned by the context
+ */
+Pixel *renderPass(RenderContext *ctx, const RenderOptions *options, int stride,
+                  RenderStats *stats) {
+  if (!options)
+    options = &DEFAULT_RENDER_OPTIONS;
+  RenderStats counts = {0};
+
+  int coarser = ctx->passStride;
+  if (!coarser || stride >= coarser) {
+    ctx->frameValid = false;
+    prepareFrame(ctx, options);
+    coarser = 0;
+  }
+  tracePrimary(ctx, options, stride, coarser, &counts);
+
+  if (stride == 1) {
+    resolveFrame(ctx, options, &counts);
+  } else {
+    int imgWidth = ctx->view.imgWidth;
+    for (int y = 0; y < ctx->view.imgHeight; y++) {
+      Pixel *source = &ctx->primary[(y - y % stride) * imgWidth];
+      Pixel *row = &ctx->buffer[y * imgWidth];
+      for (int x = 0; x < imgWidth; x++)
+        row[x] = source[x - x % stride];
+    }
+    ctx->passStride = stride;
+  }
+
+  if (stats)
+    *stats = counts;
+  return ctx->buffer;
+}
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef _SCENE_H_
+#define _SCENE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PixTool.h"
+#include "RayTracer.h"
+#include "VectorMath.h"
+
+/**
+ * Sphere geometry as touched by traversal: 16 bytes, four to a cache line.
+ * Positions are 32-bit floats in every build (the kernels convert to real)
+ * and the radius is stored squared since that is all intersection needs.
+ */
+typedef struct {
+  float center[3];
+  float radius2;
+} SphereGeom;
+
+/**
+ * Plane geometry as touched by traversal
+ */
+typedef struct {
+  float normal[3];
+  float position[3];
+} PlaneGeom;
+
+/**
+ * Surface response beyond the diffuse color: a highlight under lights and
+ * a mirror reflection
+ */
+typedef struct {
+  float shininess;
+  float reflectivity;
+  Pixel specular;
+} Material;
+
+/**
+ * A point light, or a spot light when spot is set
+ */
+typedef struct {
+  float position[3];
+  float color[3];
+  // unit axis of a spot light's cone and the cosine of its half-angle
+  float direction[3];
+  float cosTheta;
+  float radial[3];
+  float angular0;
+  bool spot;
+} LightGeom;
+
+/**
+ * A loaded scene, stored as one packed array per primitive type. Colors are
+ * kept apart from the geometry so intersection tests never pull them into
+ * the cache.
+ *
+ * Objects hit by a ray are identified by a single index: spheres are
+ * 0 .. numSpheres - 1 and planes follow as numSpheres + plane index.
+ */
+typedef struct {
+  int numCameras;
+  real cameraWidth;
+  real cameraHeight;
+
+  size_t numSpheres;
+  size_t sphereCapacity;
+  SphereGeom *spheres;
+  Pixel *sphereColors;
+  // per-frame motion, three floats per sphere; NULL while every sphere is
+  // static so still scenes do not pay for it
+  float *sphereVelocities;
+  // specular or reflective materials, NULL until an object of that type
+  // has one
+  Material *sphereMaterials;
+
+  size_t numPlanes;
+  size_t planeCapacity;
+  PlaneGeom *planes;
+  Pixel *planeColors;
+  Material *planeMaterials;
+  // set once any object has a reflectivity
+  bool reflective;
+
+  // without lights, objects are shaded flat in their color
+  size_t numLights;
+  size_t lightCapacity;
+  LightGeom *lights;
+} Scene;
+
+/**
+ * Creates an empty scene with the default 2x2 camera
+ *
+ * @return the scene, freed with freeScene()
+ */
+Scene *newScene(void) {
+  Scene *scene = calloc(1, sizeof(Scene));
+  scene->cameraWidth = 2;
+  scene->cameraHeight = 2;
+  return scene;
+}
+
+/**
+ * Resizes a packed array to hold capacity elements, exiting if memory
+ * runs out
+ */
+static void *resizeArray(void *array, size_t capacity, size_t elemSize) {
+  array = realloc(array, capacity * elemSize);
+  if (array == NULL) {
+    fprintf(stderr, "Error: Out of memory growing an array to %zu bytes\n",
+            capacity * elemSize);
+    exit(1);
+  }
+  return array;
+}
+
+/**
+ * Allocates an optional per-object array the first time an object needs
+ * it, zeroed for the objects added before
+ */
+static void *optionalArray(void *array, size_t capacity, size_t elemSize) {
+  if (array)
+    return array;
+  array = calloc(capacity, elemSize);
+  if (array == NULL) {
+    fprintf(stderr, "Error: Out of memory growing the scene\n");
+    exit(1);
+  }
+  return array;
+}
+
+static size_t grownCapacity(size_t capacity) {
+  return capacity ? capacity * 2 : 64;
+}
+
+/**
+ * The material of a parsed object, false if it has neither a specular
+ * highlight nor a reflection
+ */
+static bool objectMaterial(Object *object, Material *material) {
+  Pixel specular = object->specularColor;
+  if (specular.r == 0 && specular.g == 0 && specular.b == 0 &&
+      object->reflectivity <= 0)
+    return false;
+  material->specular = specular;
+  material->shininess = object->shininess > 0 ? object->shininess : 20;
+  material->reflectivity = object->reflectivity;
+  return true;
+}
+
+/**
+ * Appends a parsed object to the scene's packed arrays
+ *
+ * @param scene
+ * @param object the parsed object, copied
+ */
+void sceneAddObject(Scene *scene, Object *object) {
+  if (object->type == CAMERA) {
+    scene->cameraWidth = object->Camera.width;
+    scene->cameraHeight = object->Camera.height;
+    scene->numCameras++;
+
+  } else if (object->type == SPHERE) {
+    if (scene->numSpheres == scene->sphereCapacity) {
+      size_t capacity = grownCapacity(scene->sphereCapacity);
+      scene->spheres = resizeArray(scene->spheres, capacity, sizeof(SphereGeom));
+      scene->sphereColors = resizeArray(scene->sphereColors, capacity, sizeof(Pixel));
+      if (scene->sphereVelocities)
+        scene->sphereVelocities = resizeArray(scene->sphereVelocities, capacity,
+                                              3 * sizeof(float));
+      if (scene->sphereMaterials)
+        scene->sphereMaterials = resizeArray(scene->sphereMaterials, capacity,
+                                             sizeof(Material));
+      scene->sphereCapacity = capacity;
+    }
+    size_t i = scene->numSpheres;
+    real *velocity = object->Sphere.velocity;
+    if (velocity[0] != 0 || velocity[1] != 0 || velocity[2] != 0)
+      scene->sphereVelocities = optionalArray(
+          scene->sphereVelocities, scene->sphereCapacity, 3 * sizeof(float));
+    Material material;
+    if (objectMaterial(object, &material)) {
+      scene->sphereMaterials = optionalArray(
+          scene->sphereMaterials, scene->sphereCapacity, sizeof(Material));
+      scene->sphereMaterials[i] = material;
+      scene->reflective |= material.reflectivity > 0;
+    } else if (scene->sphereMaterials) {
+      memset(&scene->sphereMaterials[i], 0, sizeof(Material));
+    }
+
+    SphereGeom *sphere = &scene->spheres[i];
+    for (int a = 0; a < 3; a++)
+      sphere->center[a] = object->Sphere.position[a];
+    sphere->radius2 = sqr(object->Sphere.radius);
+    scene->sphereColors[i] = object->color;
+    if (scene->sphereVelocities)
+      for (int a = 0; a < 3; a++)
+        scene->sphereVelocities[3 * i + a] = velocity[a];
+    scene->numSpheres++;
+
+  } else if (object->type == PLANE) {
+    if (scene->numPlanes == scene->planeCapacity) {
+      size_t capacity = grownCapacity(scene->planeCapacity);
+      scene->planes = resizeArray(scene->planes, capacity, sizeof(PlaneGeom));
+      scene->planeColors = resizeArray(scene->planeColors, capacity, sizeof(Pixel));
+      if (scene->planeMaterials)
+        scene->planeMaterials = resizeArray(scene->planeMaterials, capacity,
+                                            sizeof(Material));
+      scene->planeCapacity = capacity;
+    }
+    size_t j = scene->numPlanes;
+    Material material;
+    if (objectMaterial(object, &material)) {
+      scene->planeMaterials = optionalArray(
+          scene->planeMaterials, scene->planeCapacity, sizeof(Material));
+      scene->planeMaterials[j] = material;
+      scene->reflective |= material.reflectivity > 0;
+    } else if (scene->planeMaterials) {
+      memset(&scene->planeMaterials[j], 0, sizeof(Material));
+    }
+
+    PlaneGeom *plane = &scene->planes[j];
+    for (int a = 0; a < 3; a++) {
+      plane->normal[a] = object->Plane.normal[a];
+      plane->position[a] = object->Plane.position[a];
+    }
+    scene->planeColors[j] = object->color;
+    scene->numPlanes++;
+
+  } else if (object->type == LIGHT) {
+    if (scene->numLights == scene->lightCapacity) {
+      scene->lightCapacity = grownCapacity(scene->lightCapacity);
+      scene->lights = resizeArray(scene->lights, scene->lightCapacity,
+                                  sizeof(LightGeom));
+    }
+    LightGeom *light = &scene->lights[scene->numLights++];
+    memset(light, 0, sizeof(LightGeom));
+    for (int a = 0; a < 3; a++) {
+      light->position[a] = object->Light.position[a];
+      light->color[a] = object->Light.color[a];
+      light->radial[a] = object->Light.radial[a];
+    }
+    // no attenuation unless asked for
+    if (light->radial[0] == 0 && light->radial[1] == 0 && light->radial[2] == 0)
+      light->radial[0] = 1;
+    light->angular0 = object->Light.angular0;
+
+    real direction[3];
+    vectorCopy(direction, object->Light.direction);
+    if (object->Light.theta > 0 && vectorDot(direction, direction) > 0) {
+      normalize(direction);
+      for (int a = 0; a < 3; a++)
+        light->direction[a] = direction[a];
+      light->cosTheta = cos(object->Light.theta * (PI / 180));
+      light->spot = true;
+    }
+  }
+}
+
+/**
+ * Returns the material of the object with the given hit index, or
+ * NULL if it has none
+ */
+static inline const Material *sceneMaterial(Scene *scene, int hit) {
+  const Material *material;
+  if (hit < (long)scene->numSpheres) {
+    if (!scene->sphereMaterials)
+      return NULL;
+    material = &scene->sphereMaterials[hit];
+  } else {
+    if (!scene->planeMaterials)
+      return NULL;
+    material = &scene->planeMaterials[hit - scene->numSpheres];
+  }
+  return material->shininess > 0 ? material : NULL;
+}
+
+/**
+ * Returns the color of the object with the given hit index
+ */
+static inline Pixel sceneColor(Scene *scene, int hit) {
+  if (hit < (long)scene->numSpheres)
+    return scene->sphereColors[hit];
+  return scene->planeColors[hit - scene->numSpheres];
+}
+
+/**
+ * Bytes of primitive data held by the scene (excluding spare capacity)
+ */
+size_t sceneBytes(Scene *scene) {
+  size_t bytes = scene->numSpheres * (sizeof(SphereGeom) + sizeof(Pixel)) +
+                 scene->numPlanes * (sizeof(PlaneGeom) + sizeof(Pixel));
+  if (scene->sphereVelocities)
+    bytes += scene->numSpheres * 3 * sizeof(float);
+  if (scene->sphereMaterials)
+    bytes += scene->numSpheres * sizeof(Material);
+  if (scene->planeMaterials)
+    bytes += scene->numPlanes * sizeof(Material);
+  return bytes + scene->numLights * sizeof(LightGeom);
+}
+
+void freeScene(Scene *scene) {
+  free(scene->spheres);
+  free(scene->sphereColors);
+  free(scene->sphereVelocities);
+  free(scene->sphereMaterials);
+  free(scene->planes);
+  free(scene->planeColors);
+  free(scene->planeMaterials);
+  free(scene->lights);
+  free(scene);
+}
+
+#endif
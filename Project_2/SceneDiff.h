@@ -0,0 +1,193 @@
+#ifndef _SCENEDIFF_H_
+#define _SCENEDIFF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Renderer.h"
+#include "Scene.h"
+#include "Tiles.h"
+
+/**
+ * What changed between two versions of a scene and how much of the previous
+ * frame survives
+ */
+typedef struct {
+  long spheresAdded;
+  long spheresRemoved;
+  long dirtyTiles;
+  long totalTiles;
+  // the previous frame cannot be reused, the next render traces everything
+  bool full;
+} SceneUpdate;
+
+/**
+ * FNV-1a over a block of bytes, chained through h
+ */
+static uint64_t hashBytes(const void *data, size_t size, uint64_t h) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * A sphere's content hash (geometry and color) and its index in its scene
+ */
+typedef struct {
+  uint64_t hash;
+  int index;
+} HashedSphere;
+
+static int compareHashedSpheres(const void *a, const void *b) {
+  const HashedSphere *x = a;
+  const HashedSphere *y = b;
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->index - y->index;
+}
+
+/**
+ * Hashes every sphere of a scene and sorts them by hash
+ */
+static HashedSphere *hashSpheres(Scene *scene) {
+  HashedSphere *hashed =
+      malloc(sizeof(HashedSphere) * (scene->numSpheres ? scene->numSpheres : 1));
+  for (size_t i = 0; i < scene->numSpheres; i++) {
+    uint64_t h = hashBytes(&scene->spheres[i], sizeof(SphereGeom),
+                           14695981039346656037ULL);
+    hashed[i].hash = hashBytes(&scene->sphereColors[i], sizeof(Pixel), h);
+    hashed[i].index = i;
+  }
+  qsort(hashed, scene->numSpheres, sizeof(HashedSphere), compareHashedSpheres);
+  return hashed;
+}
+
+static bool sameSphere(Scene *a, int i, Scene *b, int j) {
+  return memcmp(&a->spheres[i], &b->spheres[j], sizeof(SphereGeom)) == 0 &&
+         memcmp(&a->sphereColors[i], &b->sphereColors[j], sizeof(Pixel)) == 0;
+}
+
+static bool samePlanes(Scene *a, Scene *b) {
+  return a->numPlanes == b->numPlanes &&
+         memcmp(a->planes, b->planes, sizeof(PlaneGeom) * a->numPlanes) == 0 &&
+         memcmp(a->planeColors, b->planeColors, sizeof(Pixel) * a->numPlanes) == 0;
+}
+
+static void markTiles(RenderContext *ctx, int16_t *rect) {
+  for (int ty = rect[1]; ty <= rect[3]; ty++)
+    for (int tx = rect[0]; tx <= rect[2]; tx++)
+      ctx->dirty[ty * ctx->grid.tilesX + tx] = 1;
+}
+
+/**
+ * Replaces the context's scene with an edited version of it. The spheres of
+ * both versions are matched by content hash; every tile whose candidate
+ * list held a sphere that went away, or that a new or moved sphere's screen
+ * bounds now cover, is flagged dirty, and the next renderFrame() traces only
+ * those. Any change to the planes invalidates the whole frame since planes
+ * cover every tile, and so does any change to a lit scene since shadows
+ * fall outside the tiles of their casters.
+ *
+ * @param ctx the context, its current scene is left to the caller to free
+ * @param scene the new version of the scene
+ * @return what changed
+ */
+SceneUpdate updateScene(RenderContext *ctx, Scene *scene) {
+  Scene *old = ctx->scene;
+  SceneUpdate update = {0};
+
+  HashedSphere *before = hashSpheres(old);
+  HashedSphere *after = hashSpheres(scene);
+
+  // merge the sorted hashes; equal content keeps its relative order
+  int *oldToNew = malloc(sizeof(int) * (old->numSpheres ? old->numSpheres : 1));
+  uint8_t *matched = calloc(scene->numSpheres ? scene->numSpheres : 1, 1);
+  for (size_t i = 0; i < old->numSpheres; i++)
+    oldToNew[i] = -1;
+  size_t a = 0, b = 0;
+  while (a < old->numSpheres && b < scene->numSpheres) {
+    if (before[a].hash < after[b].hash) {
+      a++;
+    } else if (before[a].hash > after[b].hash) {
+      b++;
+    } else {
+      if (sameSphere(old, before[a].index, scene, after[b].index)) {
+        oldToNew[before[a].index] = after[b].index;
+        matched[after[b].index] = 1;
+      }
+      a++;
+      b++;
+    }
+  }
+  free(before);
+  free(after);
+
+  for (size_t i = 0; i < old->numSpheres; i++)
+    update.spheresRemoved += oldToNew[i] < 0;
+  for (size_t j = 0; j < scene->numSpheres; j++)
+    update.spheresAdded += !matched[j];
+
+  ctx->scene = scene;
+  // lights make every sphere's shadow reach beyond its own tiles, and
+  // reflections its image
+  update.full = !ctx->frameValid || !samePlanes(old, scene) ||
+                old->numLights || scene->numLights || old->reflective ||
+                scene->reflective;
+  invalidateSceneGrids(ctx);
+
+  if (ctx->gridValid && !update.full) {
+    TileGrid *grid = &ctx->grid;
+    update.totalTiles = grid->tilesX * grid->tilesY;
+
+    // old bounds come from the grid built for the old scene
+    for (size_t i = 0; i < old->numSpheres; i++)
+      if (oldToNew[i] < 0 && grid->rects[4 * i] >= 0)
+        markTiles(ctx, &grid->rects[4 * i]);
+    for (size_t j = 0; j < scene->numSpheres; j++) {
+      int16_t rect[4];
+      if (!matched[j] && sphereTileRect(&ctx->view, &scene->spheres[j], rect))
+        markTiles(ctx, rect);
+    }
+
+    // the surviving tiles keep their pixels, but their hit indices must
+    // follow the renumbering for the anti-aliasing edge test
+    int imgWidth = ctx->view.imgWidth;
+    for (int y = 0; y < ctx->view.imgHeight; y++) {
+      for (int x = 0; x < imgWidth; x++) {
+        int tile = (y / TILE_SIZE) * grid->tilesX + x / TILE_SIZE;
+        int *hit = &ctx->hits[y * imgWidth + x];
+        if (ctx->dirty[tile] || *hit < 0)
+          continue;
+        if (*hit >= (long)old->numSpheres)
+          *hit += scene->numSpheres - old->numSpheres;
+        else if (oldToNew[*hit] >= 0)
+          *hit = oldToNew[*hit];
+        else
+          ctx->dirty[tile] = 1;
+      }
+    }
+
+    for (long t = 0; t < update.totalTiles; t++)
+      update.dirtyTiles += ctx->dirty[t];
+  }
+
+  if (update.full) {
+    ctx->frameValid = false;
+    if (ctx->gridValid)
+      update.dirtyTiles = update.totalTiles =
+          ctx->grid.tilesX * ctx->grid.tilesY;
+  }
+  if (ctx->gridValid)
+    rebuildTileGrid(ctx);
+
+  free(oldToNew);
+  free(matched);
+  return update;
+}
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * Procedural scene generator for benchmarking the raycaster.
+ *
+ * Writes a scene JSON file in the same format as objects.json: one camera,
+ * a floor and a back wall plane, and a configurable number of spheres laid
+ * out inside the camera frustum.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "VectorMath.h"
+
+static const char cli_help_text[] =
+    "scenegen [sphere count] [uniform|clustered|overlap] [output file] [seed]\n"
+    "Description -- Generates a raycaster scene with the given number of spheres\n";
+
+// camera extents; the image plane sits at z = 1 so this is a 90 degree view
+static const double CAM_WIDTH = 2;
+static const double CAM_HEIGHT = 2;
+
+// depth range the spheres are placed in
+static const double NEAR_Z = 4;
+static const double FAR_Z = 40;
+
+/**
+ * xorshift64* so that a given seed produces the same scene on every platform
+ */
+static uint64_t rngState = 1;
+
+static double nextRandom(void) {
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return (double)((rngState * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double randomRange(double lo, double hi) {
+  return lo + (hi - lo) * nextRandom();
+}
+
+/**
+ * Returns a normally distributed random number (Box-Muller)
+ */
+static double randomGaussian(void) {
+  double u = nextRandom();
+  double v = nextRandom();
+  if (u < 1e-12)
+    u = 1e-12;
+  return sqrt(-2 * log(u)) * cos(2 * PI * v);
+}
+
+/**
+ * Picks a random point inside the camera frustum between the given depths
+ *
+ * @param p the resulting point
+ */
+static void randomInFrustum(double zmin, double zmax, double *p) {
+  p[2] = randomRange(zmin, zmax);
+  p[0] = randomRange(-0.9, 0.9) * p[2] * CAM_WIDTH / 2;
+  p[1] = randomRange(-0.9, 0.9) * p[2] * CAM_HEIGHT / 2;
+}
+
+static void writeSphere(FILE *out, double *p, double r) {
+  fprintf(out,
+          ",\n  {\n    \"type\": \"sphere\",\n"
+          "    \"color\": [%d, %d, %d],\n"
+          "    \"position\": [%.6g, %.6g, %.6g],\n"
+          "    \"radius\": %.6g\n  }",
+          (int)randomRange(32, 256), (int)randomRange(32, 256),
+          (int)randomRange(32, 256), p[0], p[1], p[2], r);
+}
+
+/**
+ * Spheres spread evenly through the frustum, sized relative to the mean
+ * spacing so the screen coverage is similar for every sphere count
+ */
+static void writeUniform(FILE *out, long count) {
+  double volume = CAM_WIDTH * CAM_HEIGHT / 3 *
+                  (pow(FAR_Z, 3) - pow(NEAR_Z, 3));
+  double spacing = cbrt(volume / count);
+  double radius = fmin(0.35 * spacing, 2);
+
+  for (long i = 0; i < count; i++) {
+    double p[3];
+    randomInFrustum(NEAR_Z, FAR_Z, p);
+    writeSphere(out, p, radius * randomRange(0.5, 1));
+  }
+}
+
+/**
+ * Spheres grouped in gaussian clusters around a few random centers, leaving
+ * most of the screen empty and a few regions very dense
+ */
+static void writeClustered(FILE *out, long count) {
+  long numClusters = (long)sqrt((double)count) / 4 + 1;
+  double (*centers)[3] = malloc(sizeof(double[3]) * numClusters);
+  for (long i = 0; i < numClusters; i++)
+    randomInFrustum(NEAR_Z + 4, FAR_Z - 4, centers[i]);
+
+  double perCluster = (double)count / numClusters;
+  double sigma = 1.5;
+  double radius = fmin(0.5 * sigma / cbrt(perCluster), 1);
+
+  for (long i = 0; i < count; i++) {
+    double *c = centers[i % numClusters];
+    double p[3] = {c[0] + sigma * randomGaussian(),
+                   c[1] + sigma * randomGaussian(),
+                   c[2] + sigma * randomGaussian()};
+    if (p[2] < 2)
+      p[2] = 2;
+    writeSphere(out, p, radius * randomRange(0.5, 1));
+  }
+  free(centers);
+}
+
+/**
+ * Large spheres packed into a small volume in front of the camera so that
+ * almost every primary ray crosses many of them
+ */
+static void writeOverlap(FILE *out, long count) {
+  for (long i = 0; i < count; i++) {
+    double p[3];
+    randomInFrustum(8, 12, p);
+    writeSphere(out, p, randomRange(1, 2.5));
+  }
+}
+
+/**
+ *  Main
+ *
+ * @param argc
+ * @param argv
+ * @return 0 if success with all other values representing failure modes
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    printf("%s", cli_help_text);
+    fprintf(stderr, "Error: Not enough arguments\n");
+    exit(1);
+  }
+
+  long count = strtol(argv[1], (char **)NULL, 10);
+  if (count < 1) {
+    fprintf(stderr, "Error: Sphere count must be at least 1. Found %s\n",
+            argv[1]);
+    exit(1);
+  }
+
+  char *layout = argv[2];
+  if (argc > 4)
+    rngState = strtoull(argv[4], (char **)NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+
+  // checked before the file is created, so a typo leaves nothing behind
+  void (*writeLayout)(FILE *, long);
+  if (strcmp(layout, "uniform") == 0) {
+    writeLayout = writeUniform;
+  } else if (strcmp(layout, "clustered") == 0) {
+    writeLayout = writeClustered;
+  } else if (strcmp(layout, "overlap") == 0) {
+    writeLayout = writeOverlap;
+  } else {
+    fprintf(stderr, "Error: Unknown layout \"%s\"\n", layout);
+    exit(1);
+  }
+
+  FILE *out = fopen(argv[3], "w");
+  if (!out) {
+    fprintf(stderr, "Error: Failed to open file %s\n", argv[3]);
+    exit(1);
+  }
+
+  fprintf(out,
+          "[\n  {\n    \"type\": \"camera\",\n"
+          "    \"width\": %g,\n    \"height\": %g\n  },\n"
+          "  {\n    \"type\": \"plane\",\n"
+          "    \"color\": [90, 90, 90],\n"
+          "    \"position\": [0, %g, 0],\n"
+          "    \"normal\": [0, 1, 0]\n  },\n"
+          "  {\n    \"type\": \"plane\",\n"
+          "    \"color\": [40, 40, 70],\n"
+          "    \"position\": [0, 0, %g],\n"
+          "    \"normal\": [0, 0, -1]\n  }",
+          CAM_WIDTH, CAM_HEIGHT, -FAR_Z * CAM_HEIGHT / 2, FAR_Z + 10);
+
+  writeLayout(out, count);
+
+  fprintf(out, "\n]\n");
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,370 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PixTool.h"
+#include "JSONParser.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneDiff.h"
+
+/**
+ * Longest request line the server accepts
+ */
+#define MAX_REQUEST 4096
+
+// spells out a numeric limit in an error message
+#define LIMIT_STRING(n) #n
+#define LIMIT_TEXT(n) LIMIT_STRING(n)
+
+/**
+ * One render request: the image size, the output path and optional camera
+ * and anti-aliasing overrides
+ */
+typedef struct {
+  int width;
+  int height;
+  char *out;
+  real cameraWidth;
+  real cameraHeight;
+  RenderOptions options;
+} RenderRequest;
+
+/**
+ * Parses a request line of whitespace separated key=value pairs, e.g.
+ * "width=640 height=480 out=frame.ppm camera_width=4 aa=3"
+ *
+ * @param line the request, modified in place; request->out points into it
+ * @param scene supplies the default camera
+ * @param request the parsed request
+ * @return NULL on success, otherwise a message describing the problem
+ */
+const char *parseRequest(char *line, Scene *scene, RenderRequest *request) {
+  request->width = 0;
+  request->height = 0;
+  request->out = NULL;
+  request->cameraWidth = scene->cameraWidth;
+  request->cameraHeight = scene->cameraHeight;
+  request->options = DEFAULT_RENDER_OPTIONS;
+
+  for (char *token = strtok(line, " \t\r\n"); token;
+       token = strtok(NULL, " \t\r\n")) {
+    char *value = strchr(token, '=');
+    if (!value)
+      return "expected key=value";
+    *value++ = 0;
+
+    if (strcmp(token, "width") == 0) {
+      request->width = strtol(value, (char **)NULL, 10);
+    } else if (strcmp(token, "height") == 0) {
+      request->height = strtol(value, (char **)NULL, 10);
+    } else if (strcmp(token, "out") == 0) {
+      request->out = value;
+    } else if (strcmp(token, "camera_width") == 0) {
+      request->cameraWidth = strtod(value, (char **)NULL);
+    } else if (strcmp(token, "camera_height") == 0) {
+      request->cameraHeight = strtod(value, (char **)NULL);
+    } else if (strcmp(token, "aa") == 0) {
+      request->options.aaSamples = strtol(value, (char **)NULL, 10);
+    } else if (strcmp(token, "aa_threshold") == 0) {
+      request->options.aaThreshold = strtol(value, (char **)NULL, 10);
+    } else if (strcmp(token, "bounces") == 0) {
+      request->options.maxBounces = strtol(value, (char **)NULL, 10);
+    } else if (strcmp(token, "wavefront") == 0) {
+      request->options.wavefront = strtol(value, (char **)NULL, 10) != 0;
+    } else {
+      return "unknown key";
+    }
+  }
+
+  if (request->width < 1 || request->height < 1)
+    return "width and height must be at least 1";
+  if (!request->out)
+    return "missing out=<path>";
+  if (request->options.aaSamples < 0 ||
+      request->options.aaSamples > MAX_AA_SAMPLES)
+    return "aa must be between 0 and " LIMIT_TEXT(MAX_AA_SAMPLES);
+  if (request->options.aaThreshold < 0)
+    return "aa_threshold must not be negative";
+  if (request->options.maxBounces < 0)
+    return "bounces must not be negative";
+  if (request->cameraWidth <= 0 || request->cameraHeight <= 0)
+    return "camera width and height must be positive";
+  return NULL;
+}
+
+/**
+ * Renders one request against the resident scene and writes the result.
+ * Failures are reported to the client and never end the server.
+ *
+ * @param ctx the context holding the resident scene and buffers
+ * @param line the request line
+ * @param reply where the response line is written
+ */
+void handleRequest(RenderContext *ctx, char *line, FILE *reply) {
+  double start = nowMs();
+
+  RenderRequest request;
+  const char *error = parseRequest(line, ctx->scene, &request);
+  if (error) {
+    fprintf(reply, "error %s\n", error);
+    fflush(reply);
+    return;
+  }
+
+  // a bad path is reported before the render, not after it
+  FILE *outputPPM = fopen(request.out, "wb");
+  if (!outputPPM) {
+    fprintf(reply, "error failed to open %s\n", request.out);
+    fflush(reply);
+    return;
+  }
+
+  bool rebuilt = setRenderView(ctx, request.cameraWidth, request.cameraHeight,
+                               request.width, request.height);
+  double setupEnd = nowMs();
+
+  RenderStats stats;
+  Pixel *buffer = renderFrame(ctx, &request.options, &stats);
+  double renderEnd = nowMs();
+
+  bufferToBinary(buffer, request.width, request.height, outputPPM);
+  bool written = !ferror(outputPPM);
+  if (fclose(outputPPM) != 0 || !written) {
+    fprintf(reply, "error failed to write %s\n", request.out);
+    fflush(reply);
+    return;
+  }
+  double end = nowMs();
+
+  fprintf(reply,
+          "ok out=%s width=%d height=%d grid=%s tiles=%ld/%d setup_ms=%.3f "
+          "render_ms=%.3f write_ms=%.3f total_ms=%.3f rays=%ld refined=%ld\n",
+          request.out, request.width, request.height,
+          rebuilt ? "rebuilt" : "reused", stats.tilesTraced,
+          ctx->grid.tilesX * ctx->grid.tilesY, setupEnd - start,
+          renderEnd - setupEnd, end - renderEnd, end - start,
+          stats.primaryRays + stats.aaRays, stats.refinedPixels);
+  fflush(reply);
+}
+
+/**
+ * Copies a file into a new temporary file in $TMPDIR, or /tmp if unset
+ *
+ * @param path the file to copy
+ * @param copy receives the path of the copy
+ * @param size size of copy in bytes
+ * @return false if either file could not be opened or written
+ */
+static bool snapshotFile(const char *path, char *copy, size_t size) {
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !*dir)
+    dir = "/tmp";
+  if (snprintf(copy, size, "%s/raycast-reload-XXXXXX", dir) >= (int)size)
+    return false;
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return false;
+  int fd = mkstemp(copy);
+  FILE *out = fd < 0 ? NULL : fdopen(fd, "wb");
+  if (!out) {
+    if (fd >= 0) {
+      close(fd);
+      unlink(copy);
+    }
+    fclose(in);
+    return false;
+  }
+
+  char block[65536];
+  size_t n;
+  bool ok = true;
+  while ((n = fread(block, 1, sizeof(block), in)) > 0)
+    ok &= fwrite(block, 1, n, out) == n;
+  ok &= !ferror(in);
+  fclose(in);
+  ok &= fclose(out) == 0;
+  if (!ok)
+    unlink(copy);
+  return ok;
+}
+
+/**
+ * Loads a scene without risking the server: readScene() ends the process
+ * on a malformed file, so a copy of the file is first parsed in a child
+ * process, and only parsed here once the child succeeded. Working on a copy
+ * keeps a file still being saved from changing between the two.
+ *
+ * @param path the scene file
+ * @return the scene, or NULL if it could not be loaded
+ */
+static Scene *loadSceneIsolated(const char *path) {
+  char copy[4096];
+  if (!snapshotFile(path, copy, sizeof(copy)))
+    return NULL;
+
+  // nothing buffered may be written twice by the child's exit
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    Scene *scene = readScene(copy);
+    _exit(scene ? 0 : 1);
+  }
+
+  int status;
+  bool parsed = pid > 0 && waitpid(pid, &status, 0) == pid &&
+                WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  Scene *scene = parsed ? readScene(copy) : NULL;
+  unlink(copy);
+  return scene;
+}
+
+/**
+ * Loads a new version of the scene and swaps it in. Unchanged spheres keep
+ * their pixels: the next render only re-traces the tiles the edit touched.
+ * A file that fails to parse is reported and leaves the scene as it was.
+ *
+ * @param ctx the context holding the resident scene
+ * @param path the scene file to load
+ * @param reply where the response line is written
+ */
+void handleReload(RenderContext *ctx, char *path, FILE *reply) {
+  double start = nowMs();
+  Scene *scene = loadSceneIsolated(path);
+  if (!scene) {
+    // the resident scene stays as it was
+    fprintf(reply, "error failed to load %s\n", path);
+    fflush(reply);
+    return;
+  }
+  double loaded = nowMs();
+
+  Scene *old = ctx->scene;
+  SceneUpdate update = updateScene(ctx, scene);
+  freeScene(old);
+  double end = nowMs();
+
+  fprintf(reply,
+          "ok reload=%s added=%ld removed=%ld dirty_tiles=%ld/%ld%s "
+          "load_ms=%.3f diff_ms=%.3f\n",
+          path, update.spheresAdded, update.spheresRemoved, update.dirtyTiles,
+          update.totalTiles, update.full ? " full" : "", loaded - start,
+          end - loaded);
+  fflush(reply);
+}
+
+/**
+ * Answers request lines until the input ends or a "quit" line arrives.
+ * "reload [path]" swaps in a new version of the scene, by default from the
+ * file it was first loaded from.
+ *
+ * @param ctx the context holding the resident scene and buffers
+ * @param scenePath the file the resident scene was loaded from
+ * @param in request stream
+ * @param reply response stream, one line per request
+ * @return true if the client asked the server to quit
+ */
+bool serveRequests(RenderContext *ctx, char *scenePath, FILE *in,
+                   FILE *reply) {
+  char line[MAX_REQUEST];
+  while (fgets(line, sizeof(line), in)) {
+    if (strncmp(line, "quit", 4) == 0)
+      return true;
+    if (strspn(line, " \t\r\n") == strlen(line))
+      continue;
+    if (strncmp(line, "reload", 6) == 0 && strchr(" \t\r\n", line[6])) {
+      char *path = strtok(line + 6, " \t\r\n");
+      handleReload(ctx, path ? path : scenePath, reply);
+      continue;
+    }
+    handleRequest(ctx, line, reply);
+  }
+  return false;
+}
+
+/**
+ * Accepts connections on a Unix domain socket, one at a time, and answers
+ * their requests until one of them sends "quit"
+ *
+ * @param ctx the context holding the resident scene and buffers
+ * @param scenePath the file the resident scene was loaded from
+ * @param path filesystem path of the socket, replaced if it exists
+ * @return 0 on a clean shutdown, 1 if the socket failed
+ */
+int runSocketServer(RenderContext *ctx, char *scenePath, const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: Socket path too long: %s\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 8) < 0) {
+    fprintf(stderr, "Error: Failed to listen on %s\n", path);
+    return 1;
+  }
+
+  // a client hanging up mid-reply must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  bool quit = false;
+  int status = 0;
+  while (!quit) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        // out of descriptors or memory for now, retrying at once would spin
+        nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+        continue;
+      }
+      fprintf(stderr, "Error: Failed to accept on %s: %s\n", path,
+              strerror(errno));
+      status = 1;
+      break;
+    }
+
+    int replyFd = dup(fd);
+    FILE *in = fdopen(fd, "r");
+    FILE *reply = replyFd < 0 ? NULL : fdopen(replyFd, "w");
+    if (!in || !reply) {
+      fprintf(stderr, "Error: Failed to open a client connection\n");
+      if (in)
+        fclose(in);
+      else
+        close(fd);
+      if (reply)
+        fclose(reply);
+      else if (replyFd >= 0)
+        close(replyFd);
+      continue;
+    }
+    quit = serveRequests(ctx, scenePath, in, reply);
+    fclose(in);
+    fclose(reply);
+  }
+
+  close(listener);
+  unlink(path);
+  return status;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef _TILES_H_
+#define _TILES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Camera.h"
+#include "CellLists.h"
+#include "Scene.h"
+#include "VectorMath.h"
+
+/**
+ * Width and height of a screen tile in pixels
+ */
+#define TILE_SIZE 16
+
+/**
+ * Screen tiles with a compact list of candidate spheres each. The lists are
+ * stored back to back: the candidates of tile t are
+ * indices[offsets[t]] .. indices[offsets[t + 1] - 1], in scene order so the
+ * closest-hit tie breaking matches a scan of the whole sphere array. Planes
+ * are unbounded and are tested by every ray instead.
+ */
+typedef struct {
+  int tilesX;
+  int tilesY;
+  int *offsets;
+  int *indices;
+  // tile range {x0, y0, x1, y1} (inclusive) covered by each sphere, x0 < 0
+  // when the sphere is not visible
+  int16_t *rects;
+} TileGrid;
+
+/**
+ * Projects a sphere onto the image and finds the range of pixels its
+ * silhouette can cover. The sphere's bounding box is projected corner by
+ * corner, which over-estimates the silhouette but never misses a pixel.
+ *
+ * @param view
+ * @param center
+ * @param r
+ * @param bounds set to {x0, y0, x1, y1}, inclusive pixel coordinates
+ * @return false if the sphere cannot be seen by any primary ray
+ */
+bool sphereScreenBounds(View *view, real *center, real r, int *bounds) {
+  double zmin = center[2] - r;
+  double zmax = center[2] + r;
+
+  // entirely behind the camera
+  if (zmax <= 0)
+    return false;
+
+  if (zmin <= 1e-6) {
+    // the sphere reaches the camera plane, it may cover anything
+    bounds[0] = 0;
+    bounds[1] = 0;
+    bounds[2] = view->imgWidth - 1;
+    bounds[3] = view->imgHeight - 1;
+    return true;
+  }
+
+  // on the image plane (z = 1) a point projects to (x / z, y / z)
+  double xlo = center[0] - r, xhi = center[0] + r;
+  double ylo = center[1] - r, yhi = center[1] + r;
+  double sxMin = fmin(xlo / zmin, xlo / zmax);
+  double sxMax = fmax(xhi / zmin, xhi / zmax);
+  double syMin = fmin(ylo / zmin, ylo / zmax);
+  double syMax = fmax(yhi / zmin, yhi / zmax);
+
+  // image plane to pixel coordinates, inverse of primaryRay(); y points down
+  double pxMin = (sxMin + view->w / 2) / view->pixwidth;
+  double pxMax = (sxMax + view->w / 2) / view->pixwidth;
+  double pyMin = (view->h / 2 - syMax) / view->pixheight;
+  double pyMax = (view->h / 2 - syMin) / view->pixheight;
+
+  // one pixel of slack absorbs rounding in the ray setup
+  double x0 = floor(pxMin) - 1, x1 = floor(pxMax) + 1;
+  double y0 = floor(pyMin) - 1, y1 = floor(pyMax) + 1;
+  if (x1 < 0 || y1 < 0 || x0 >= view->imgWidth || y0 >= view->imgHeight)
+    return false;
+
+  bounds[0] = x0 < 0 ? 0 : (int)x0;
+  bounds[1] = y0 < 0 ? 0 : (int)y0;
+  bounds[2] = x1 >= view->imgWidth ? view->imgWidth - 1 : (int)x1;
+  bounds[3] = y1 >= view->imgHeight ? view->imgHeight - 1 : (int)y1;
+  return true;
+}
+
+/**
+ * Finds the range of tiles a sphere can be seen in
+ *
+ * @param view
+ * @param sphere
+ * @param rect set to {x0, y0, x1, y1}, inclusive tile coordinates
+ * @return false if the sphere is not visible
+ */
+bool sphereTileRect(View *view, const SphereGeom *sphere, int16_t *rect) {
+  real center[3] = {sphere->center[0], sphere->center[1], sphere->center[2]};
+  int bounds[4];
+  if (!sphereScreenBounds(view, center, sqrt((real)sphere->radius2), bounds))
+    return false;
+  rect[0] = bounds[0] / TILE_SIZE;
+  rect[1] = bounds[1] / TILE_SIZE;
+  rect[2] = bounds[2] / TILE_SIZE;
+  rect[3] = bounds[3] / TILE_SIZE;
+  return true;
+}
+
+/**
+ * The tiles a sphere covers, as a box for fillCellLists()
+ */
+static bool tileBox(const void *grid, int object, int *box) {
+  const int16_t *rect = &((const TileGrid *)grid)->rects[4 * object];
+  if (rect[0] < 0)
+    return false;
+  box[0] = rect[0];
+  box[1] = rect[1];
+  box[2] = 0;
+  box[3] = rect[2];
+  box[4] = rect[3];
+  box[5] = 0;
+  return true;
+}
+
+/**
+ * Lays out the candidate lists of every tile from the spheres' tile rects.
+ * The lists are rebuilt from the cached rects alone, so a refit that moved
+ * a few spheres does not project the rest again.
+ *
+ * @param grid a grid whose rects are filled in
+ * @param numObjects number of spheres
+ */
+void fillTileLists(TileGrid *grid, int numObjects) {
+  int dims[3] = {grid->tilesX, grid->tilesY, 1};
+  fillCellLists(dims, false, tileBox, grid, numObjects, grid->offsets,
+                &grid->indices, "tile");
+}
+
+/**
+ * Bins every sphere of the scene into the screen tiles it can be seen in
+ *
+ * @param grid the grid to fill, freed with freeTileGrid()
+ * @param scene
+ * @param view
+ */
+void buildTileGrid(TileGrid *grid, Scene *scene, View *view) {
+  int numObjects = scene->numSpheres;
+
+  grid->tilesX = (view->imgWidth + TILE_SIZE - 1) / TILE_SIZE;
+  grid->tilesY = (view->imgHeight + TILE_SIZE - 1) / TILE_SIZE;
+  grid->offsets = malloc(sizeof(int) * (grid->tilesX * grid->tilesY + 1));
+  grid->indices = NULL;
+  grid->rects = malloc(sizeof(int16_t) * 4 * (numObjects ? numObjects : 1));
+
+  for (int i = 0; i < numObjects; i++) {
+    int16_t *rect = &grid->rects[4 * i];
+    if (!sphereTileRect(view, &scene->spheres[i], rect))
+      rect[0] = -1;
+  }
+  fillTileLists(grid, numObjects);
+}
+
+void freeTileGrid(TileGrid *grid) {
+  free(grid->offsets);
+  free(grid->indices);
+  free(grid->rects);
+  grid->offsets = NULL;
+  grid->indices = NULL;
+  grid->rects = NULL;
+}
+
+#endif
@@ -1,19 +1,36 @@
 #ifndef _VECTORMATH_H_
 #define _VECTORMATH_H_
 
-#include <math.h>
+#include <tgmath.h>
 
 /**
- * Define our 3D vectors as an array of doubles
+ * The scalar type used by all scene and intersection math. Doubles unless
+ * the build defines RAYCAST_FLOAT, which halves the footprint of the scene
+ * and doubles the SIMD width. <tgmath.h> picks sqrt/sqrtf etc. from the
+ * argument type so the same source compiles for both.
  */
-typedef double *V3;
+#ifdef RAYCAST_FLOAT
+typedef float real;
+#define REAL_NAME "float"
+#else
+typedef double real;
+#define REAL_NAME "double"
+#endif
+
+// M_PI is not part of strict C11
+#define PI 3.14159265358979323846
+
+/**
+ * Define our 3D vectors as an array of reals
+ */
+typedef real *V3;
 
 /**
- * Returns the double of the input double times itself (x^2)
- * @param v input double
- * @return double which is the input multiplied by itself
+ * Returns the input times itself (x^2)
+ * @param v input real
+ * @return real which is the input multiplied by itself
  */
-static inline double sqr(double v) { return v * v; }
+static inline real sqr(real v) { return v * v; }
 
 /**
  * Performs a 3D vector addition
@@ -45,7 +62,7 @@ static inline void vectorSubtract(V3 a, V3 b, V3 c) {
  * @param s
  * @param c the result of the scale operation
  */
-static inline void vectorScale(V3 a, double s, V3 c) {
+static inline void vectorScale(V3 a, real s, V3 c) {
   c[0] = s * a[0];
   c[1] = s * a[1];
   c[2] = s * a[2];
@@ -57,7 +74,7 @@ static inline void vectorScale(V3 a, double s, V3 c) {
  * @param b
  * @return returns the dot product of the two input 3D vectors
  */
-static inline double vectorDot(V3 a, V3 b) {
+static inline real vectorDot(V3 a, V3 b) {
   return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
 }
 
@@ -85,11 +102,11 @@ static inline void vectorCopy(V3 to, V3 from) {
 }
 
 /**
- *
+ * Scales a 3D vector to unit length
  * @param v
  */
-static inline void normalize(double *v) {
-  double len = sqrt(sqr(v[0]) + sqr(v[1]) + sqr(v[2]));
+static inline void normalize(real *v) {
+  real len = sqrt(sqr(v[0]) + sqr(v[1]) + sqr(v[2]));
   v[0] /= len;
   v[1] /= len;
   v[2] /= len;
@@ -0,0 +1,319 @@
+#ifndef _WAVEFRONT_H_
+#define _WAVEFRONT_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Clock.h"
+#include "Intersect.h"
+#include "Lighting.h"
+#include "PixTool.h"
+#include "PrimaryRays.h"
+#include "Scene.h"
+#include "Tiles.h"
+#include "VectorMath.h"
+#include "WorldGrid.h"
+
+/**
+ * A batch of rays stored one array per field, so every pass streams
+ * through just the fields it needs
+ */
+typedef struct {
+  size_t count;
+  size_t capacity;
+  real *ox, *oy, *oz;
+  real *dx, *dy, *dz;
+  // share of the ray's color that reaches its path's pixel
+  float *weight;
+  // the accumulation slot of the ray's path and the screen tile it
+  // started in
+  int *slot;
+  int *tile;
+  // closest hit, filled in by the intersection pass
+  int *hit;
+  real *t;
+} RayQueue;
+
+/**
+ * Counters filled in by traceWavefront()
+ */
+typedef struct {
+  long secondaryRays;
+  long intersectionTests;
+  double traceMs;
+  double shadeMs;
+} WavefrontStats;
+
+/**
+ * Everything the wavefront passes reuse between frames: the queue being
+ * processed, the one its bounces are spawned into and the color
+ * accumulated per path
+ */
+typedef struct {
+  RayQueue queues[2];
+  size_t numSlots;
+  size_t accumCapacity;
+  double *accum;
+} Wavefront;
+
+/**
+ * Makes room for at least n rays
+ */
+void reserveQueue(RayQueue *q, size_t n) {
+  if (n <= q->capacity)
+    return;
+  size_t capacity = q->capacity ? q->capacity : 1024;
+  while (capacity < n)
+    capacity *= 2;
+  q->ox = resizeArray(q->ox, capacity, sizeof(real));
+  q->oy = resizeArray(q->oy, capacity, sizeof(real));
+  q->oz = resizeArray(q->oz, capacity, sizeof(real));
+  q->dx = resizeArray(q->dx, capacity, sizeof(real));
+  q->dy = resizeArray(q->dy, capacity, sizeof(real));
+  q->dz = resizeArray(q->dz, capacity, sizeof(real));
+  q->weight = resizeArray(q->weight, capacity, sizeof(float));
+  q->slot = resizeArray(q->slot, capacity, sizeof(int));
+  q->tile = resizeArray(q->tile, capacity, sizeof(int));
+  q->hit = resizeArray(q->hit, capacity, sizeof(int));
+  q->t = resizeArray(q->t, capacity, sizeof(real));
+  q->capacity = capacity;
+}
+
+void freeQueue(RayQueue *q) {
+  free(q->ox);
+  free(q->oy);
+  free(q->oz);
+  free(q->dx);
+  free(q->dy);
+  free(q->dz);
+  free(q->weight);
+  free(q->slot);
+  free(q->tile);
+  free(q->hit);
+  free(q->t);
+  memset(q, 0, sizeof(RayQueue));
+}
+
+/**
+ * Appends a ray to a queue
+ */
+static inline void pushRay(RayQueue *q, real *Ro, real *Rd, float weight,
+                           int slot, int tile) {
+  if (q->count == q->capacity)
+    reserveQueue(q, q->count + 1);
+  size_t i = q->count++;
+  q->ox[i] = Ro[0];
+  q->oy[i] = Ro[1];
+  q->oz[i] = Ro[2];
+  q->dx[i] = Rd[0];
+  q->dy[i] = Rd[1];
+  q->dz[i] = Rd[2];
+  q->weight[i] = weight;
+  q->slot[i] = slot;
+  q->tile[i] = tile;
+}
+
+void freeWavefront(Wavefront *wf) {
+  freeQueue(&wf->queues[0]);
+  freeQueue(&wf->queues[1]);
+  free(wf->accum);
+  memset(wf, 0, sizeof(Wavefront));
+}
+
+/**
+ * Empties the queues and makes room for the colors of numSlots paths; the
+ * caller then pushes the first ray of each path into queues[0]. Only the
+ * slots that get a ray are written, so a pass over a few of the pixels
+ * does not pay for clearing them all.
+ */
+void beginWavefront(Wavefront *wf, size_t numSlots) {
+  wf->queues[0].count = 0;
+  wf->queues[1].count = 0;
+  if (3 * numSlots > wf->accumCapacity) {
+    wf->accumCapacity = 3 * numSlots;
+    wf->accum = resizeArray(wf->accum, wf->accumCapacity, sizeof(double));
+  }
+  wf->numSlots = numSlots;
+}
+
+/**
+ * The final color of a path
+ */
+static inline Pixel wavefrontColor(Wavefront *wf, int slot) {
+  double *c = &wf->accum[3 * slot];
+  Pixel color;
+  color.r = c[0] >= 255 ? 255 : (uint8_t)(c[0] + 0.5);
+  color.g = c[1] >= 255 ? 255 : (uint8_t)(c[1] + 0.5);
+  color.b = c[2] >= 255 ? 255 : (uint8_t)(c[2] + 0.5);
+  return color;
+}
+
+/**
+ * Intersection pass. Rays leaving the camera (depth 0) test the candidates
+ * of their screen tile with the primary kernels, so they must start at the
+ * origin with a unit direction; bounced rays walk the world grid. Queues
+ * are kept in the order their first rays were pushed, tile by tile, and
+ * bounces are spawned in the same order, so neighbouring rays stay next to
+ * each other at every depth without sorting.
+ */
+static void intersectPass(RayQueue *q, int depth, Scene *scene,
+                          CompiledScene *compiled, TileGrid *tiles,
+                          WorldGrid *world, WavefrontStats *stats) {
+  if (depth == 0) {
+    long tests = 0;
+    for (size_t run = 0, end; run < q->count; run = end) {
+      // each run of rays from one tile shares its candidate list
+      int tile = q->tile[run];
+      for (end = run + 1; end < q->count && q->tile[end] == tile; end++)
+        ;
+      int *candidates = &tiles->indices[tiles->offsets[tile]];
+      int count = tiles->offsets[tile + 1] - tiles->offsets[tile];
+      for (size_t i = run; i < end; i++) {
+        real Rd[3] = {q->dx[i], q->dy[i], q->dz[i]};
+        q->hit[i] = closestPrimary(compiled, candidates, count, Rd, &q->t[i]);
+      }
+      tests += (long)(count + scene->numPlanes) * (end - run);
+    }
+    stats->intersectionTests += tests;
+    return;
+  }
+
+  for (size_t i = 0; i < q->count; i++) {
+    real Ro[3] = {q->ox[i], q->oy[i], q->oz[i]};
+    real Rd[3] = {q->dx[i], q->dy[i], q->dz[i]};
+    real max = INFINITY;
+    int hit = -1;
+    stats->intersectionTests += closestInWorldGrid(world, scene, Ro, Rd, &max, &hit);
+    closestPlane(scene, Ro, Rd, &max, &hit);
+    q->hit[i] = hit;
+    q->t[i] = max;
+    stats->intersectionTests += scene->numPlanes;
+  }
+}
+
+/**
+ * The reflectivity of the object with the given hit index
+ */
+static inline float hitReflectivity(Scene *scene, int hit) {
+  if (hit < 0)
+    return 0;
+  const Material *material = sceneMaterial(scene, hit);
+  return material ? material->reflectivity : 0;
+}
+
+/**
+ * Shading pass. Adds each ray's share of its local color to its path (the
+ * first pass sets it, every path has one first ray); the reflected share
+ * is left to the bounce, unless this is the last pass and there is none.
+ * Rays are shaded in queue order, tile by tile, which keeps the per-tile
+ * occluder cache of Lighting.h effective.
+ */
+static void shadePass(Wavefront *wf, RayQueue *q, bool first, bool last,
+                      Scene *scene, LightGrid *lights, int *occluders,
+                      ShadowStats *shadow) {
+  for (size_t i = 0; i < q->count; i++) {
+    real Ro[3] = {q->ox[i], q->oy[i], q->oz[i]};
+    real Rd[3] = {q->dx[i], q->dy[i], q->dz[i]};
+    Pixel local = shadeHit(scene, lights, q->hit[i], q->t[i], Ro, Rd,
+                           &occluders[q->tile[i] * scene->numLights], shadow);
+    double share = q->weight[i];
+    if (!last)
+      share *= 1.0 - hitReflectivity(scene, q->hit[i]);
+    double *c = &wf->accum[3 * q->slot[i]];
+    if (first) {
+      c[0] = share * local.r;
+      c[1] = share * local.g;
+      c[2] = share * local.b;
+    } else {
+      c[0] += share * local.r;
+      c[1] += share * local.g;
+      c[2] += share * local.b;
+    }
+  }
+}
+
+/**
+ * Spawn pass: a mirror ray for every hit on a reflective object
+ */
+static void spawnPass(RayQueue *q, RayQueue *next, Scene *scene) {
+  for (size_t i = 0; i < q->count; i++) {
+    float reflectivity = hitReflectivity(scene, q->hit[i]);
+    if (reflectivity <= 0)
+      continue;
+
+    real Rd[3] = {q->dx[i], q->dy[i], q->dz[i]};
+    real P[3] = {q->ox[i] + q->t[i] * Rd[0], q->oy[i] + q->t[i] * Rd[1],
+                 q->oz[i] + q->t[i] * Rd[2]};
+    real N[3];
+    surfaceNormal(scene, q->hit[i], P, N);
+    real DdotN = vectorDot(Rd, N);
+    if (DdotN > 0) {
+      vectorScale(N, -1, N);
+      DdotN = -DdotN;
+    }
+
+    real R[3], origin[3];
+    for (int a = 0; a < 3; a++) {
+      R[a] = Rd[a] - 2 * DdotN * N[a];
+      origin[a] = P[a] + SHADOW_BIAS * N[a];
+    }
+    normalize(R);
+    pushRay(next, origin, R, q->weight[i] * reflectivity, q->slot[i],
+            q->tile[i]);
+  }
+}
+
+/**
+ * Traces the paths queued in queues[0] after beginWavefront() in batched
+ * passes: intersect every ray of the queue, shade every hit, spawn the
+ * reflections into the other queue, then repeat on that queue until no ray
+ * is left or maxBounces is reached.
+ *
+ * @param wf
+ * @param scene
+ * @param compiled the scene compiled for the first rays
+ * @param tiles screen tiles, for the first rays which leave the camera
+ * @param world world grid, for bounced rays
+ * @param lights one direction grid per light
+ * @param occluders last occluder of each light per screen tile
+ * @param maxBounces reflections followed per path
+ * @param firstHits if not NULL, set to each path's first hit by slot
+ * @param stats
+ * @param shadow
+ */
+void traceWavefront(Wavefront *wf, Scene *scene, CompiledScene *compiled,
+                    TileGrid *tiles, WorldGrid *world, LightGrid *lights,
+                    int *occluders, int maxBounces, int *firstHits,
+                    WavefrontStats *stats, ShadowStats *shadow) {
+  RayQueue *q = &wf->queues[0];
+  RayQueue *next = &wf->queues[1];
+  for (int depth = 0; q->count; depth++) {
+    if (depth > 0)
+      stats->secondaryRays += q->count;
+
+    double start = nowMs();
+    intersectPass(q, depth, scene, compiled, tiles, world, stats);
+    double traced = nowMs();
+    bool last = depth >= maxBounces;
+    shadePass(wf, q, depth == 0, last, scene, lights, occluders, shadow);
+    next->count = 0;
+    if (!last)
+      spawnPass(q, next, scene);
+    stats->traceMs += traced - start;
+    stats->shadeMs += nowMs() - traced;
+
+    if (depth == 0 && firstHits)
+      for (size_t i = 0; i < q->count; i++)
+        firstHits[q->slot[i]] = q->hit[i];
+
+    RayQueue *done = q;
+    q = next;
+    next = done;
+  }
+}
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef _WORLDGRID_H_
+#define _WORLDGRID_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CellLists.h"
+#include "Intersect.h"
+#include "Scene.h"
+#include "VectorMath.h"
+
+/**
+ * Largest number of cells along one axis of the world grid
+ */
+#define WORLD_GRID_MAX_RES 256
+
+/**
+ * Share of the spheres' extent a world grid's box grows by on each side
+ * when a moving sphere leaves it
+ */
+#define WORLD_GRID_MARGIN 0.25
+
+/**
+ * A uniform grid of cells over the bounding box of the spheres, for rays
+ * that do not start at the camera (reflections) and so cannot use the
+ * screen tiles. Each cell lists every sphere whose bounding box overlaps
+ * it, stored back to back as in TileGrid. Rays walk the cells they pass
+ * through in order and stop once the closest hit found lies before the next
+ * cell.
+ */
+typedef struct {
+  double lo[3];
+  double cellSize[3];
+  int res[3];
+  int *offsets;
+  int *indices;
+  // cell range {x0, y0, z0, x1, y1, z1} (inclusive) overlapped by each
+  // sphere
+  int *ranges;
+} WorldGrid;
+
+/**
+ * The range of cells a sphere's bounding box overlaps along one axis
+ */
+static inline void worldCellRange(WorldGrid *grid, const SphereGeom *sphere,
+                                  int axis, int *first, int *last) {
+  double r = sqrt(sphere->radius2);
+  // the slack keeps a sphere touching a cell wall in both cells
+  double lo = (sphere->center[axis] - r - grid->lo[axis]) / grid->cellSize[axis];
+  double hi = (sphere->center[axis] + r - grid->lo[axis]) / grid->cellSize[axis];
+  *first = lo - 1e-4 < 0 ? 0 : (int)(lo - 1e-4);
+  *last = hi + 1e-4 >= grid->res[axis] ? grid->res[axis] - 1 : (int)(hi + 1e-4);
+}
+
+/**
+ * The cells a sphere covers, as a box for fillCellLists()
+ */
+static bool worldBox(const void *grid, int object, int *box) {
+  memcpy(box, &((const WorldGrid *)grid)->ranges[6 * object], sizeof(int) * 6);
+  return true;
+}
+
+/**
+ * Lays out the candidate lists of every cell from the spheres' cell ranges
+ *
+ * @param grid a grid whose ranges are filled in
+ * @param numObjects number of spheres
+ */
+static void fillWorldLists(WorldGrid *grid, int numObjects) {
+  fillCellLists(grid->res, false, worldBox, grid, numObjects, grid->offsets,
+                &grid->indices, "world grid");
+}
+
+/**
+ * The range of cells a sphere's bounding box overlaps
+ *
+ * @param grid
+ * @param sphere
+ * @param range set to {x0, y0, z0, x1, y1, z1}
+ */
+static void sphereWorldCells(WorldGrid *grid, const SphereGeom *sphere,
+                             int *range) {
+  for (int a = 0; a < 3; a++)
+    worldCellRange(grid, sphere, a, &range[a], &range[3 + a]);
+}
+
+/**
+ * The bounding box of every sphere of the scene
+ */
+static void sphereBounds(Scene *scene, double *lo, double *hi) {
+  for (int a = 0; a < 3; a++) {
+    lo[a] = INFINITY;
+    hi[a] = -INFINITY;
+  }
+  for (size_t i = 0; i < scene->numSpheres; i++) {
+    const SphereGeom *sphere = &scene->spheres[i];
+    double r = sqrt(sphere->radius2);
+    for (int a = 0; a < 3; a++) {
+      lo[a] = fmin(lo[a], sphere->center[a] - r);
+      hi[a] = fmax(hi[a], sphere->center[a] + r);
+    }
+  }
+}
+
+void freeWorldGrid(WorldGrid *grid) {
+  free(grid->offsets);
+  free(grid->indices);
+  free(grid->ranges);
+  grid->offsets = NULL;
+  grid->indices = NULL;
+  grid->ranges = NULL;
+}
+
+/**
+ * Sizes the grid's cells for a box and bins every sphere of the scene into
+ * them. The resolution aims for about two cells per sphere, shaped like the
+ * box.
+ */
+static void layoutWorldGrid(WorldGrid *grid, Scene *scene, double *lo,
+                            double *hi) {
+  int numObjects = scene->numSpheres;
+  double extent[3], volume = 1;
+  for (int a = 0; a < 3; a++) {
+    if (!numObjects) {
+      lo[a] = 0;
+      hi[a] = 1;
+    }
+    // a flat layer of spheres still gets a cell of some thickness
+    extent[a] = fmax(hi[a] - lo[a], 1e-3);
+    volume *= extent[a];
+  }
+  double cellsPerUnit = cbrt(2.0 * (numObjects ? numObjects : 1) / volume);
+
+  int numCells = 1;
+  for (int a = 0; a < 3; a++) {
+    int res = ceil(extent[a] * cellsPerUnit);
+    grid->res[a] = res < 1 ? 1 : res > WORLD_GRID_MAX_RES ? WORLD_GRID_MAX_RES : res;
+    grid->lo[a] = lo[a];
+    grid->cellSize[a] = extent[a] / grid->res[a];
+    numCells *= grid->res[a];
+  }
+  grid->offsets = malloc(sizeof(int) * (numCells + 1));
+  grid->indices = NULL;
+  grid->ranges = malloc(sizeof(int) * 6 * (numObjects ? numObjects : 1));
+  for (int i = 0; i < numObjects; i++)
+    sphereWorldCells(grid, &scene->spheres[i], &grid->ranges[6 * i]);
+  fillWorldLists(grid, numObjects);
+}
+
+/**
+ * Bins every sphere of the scene into the cells its bounding box overlaps,
+ * over the bounding box of all spheres
+ *
+ * @param grid the grid to fill, freed with freeWorldGrid()
+ * @param scene
+ */
+void buildWorldGrid(WorldGrid *grid, Scene *scene) {
+  double lo[3], hi[3];
+  sphereBounds(scene, lo, hi);
+  layoutWorldGrid(grid, scene, lo, hi);
+}
+
+/**
+ * Refits the grid after some spheres moved: only those are binned again,
+ * and the lists are laid out anew only if one of them now overlaps other
+ * cells. A sphere that left the grid's box cannot be refit; the grid is
+ * then laid out again over a box grown by WORLD_GRID_MARGIN, so spheres
+ * moving on at the edge of the scene fit for many more frames.
+ *
+ * @param grid a grid built with buildWorldGrid()
+ * @param scene
+ * @param moved indices of the spheres that moved
+ * @param numMoved
+ * @return false if the grid had to be laid out over a new box
+ */
+bool refitWorldGrid(WorldGrid *grid, Scene *scene, const int *moved,
+                    int numMoved) {
+  bool changed = false;
+  for (int k = 0; k < numMoved; k++) {
+    const SphereGeom *sphere = &scene->spheres[moved[k]];
+    double r = sqrt(sphere->radius2);
+    bool inside = true;
+    for (int a = 0; a < 3; a++) {
+      double hi = grid->lo[a] + grid->cellSize[a] * grid->res[a];
+      inside &= sphere->center[a] - r >= grid->lo[a] &&
+                sphere->center[a] + r <= hi;
+    }
+    if (!inside) {
+      double lo[3], hi[3];
+      sphereBounds(scene, lo, hi);
+      for (int a = 0; a < 3; a++) {
+        double margin = WORLD_GRID_MARGIN * (hi[a] - lo[a]);
+        lo[a] = fmin(lo[a] - margin, grid->lo[a]);
+        hi[a] = fmax(hi[a] + margin,
+                     grid->lo[a] + grid->cellSize[a] * grid->res[a]);
+      }
+      freeWorldGrid(grid);
+      layoutWorldGrid(grid, scene, lo, hi);
+      return false;
+    }
+
+    int *range = &grid->ranges[6 * moved[k]];
+    int refit[6];
+    sphereWorldCells(grid, sphere, refit);
+    if (memcmp(range, refit, sizeof(refit)) != 0) {
+      memcpy(range, refit, sizeof(refit));
+      changed = true;
+    }
+  }
+  if (changed)
+    fillWorldLists(grid, scene->numSpheres);
+  return true;
+}
+
+
+/**
+ * Finds the closest sphere along a ray by walking the grid cells the ray
+ * passes through (Amanatides & Woo). Planes are not in the grid.
+ *
+ * @param grid
+ * @param scene
+ * @param Ro
+ * @param Rd
+ * @param max closest distance so far, updated on a closer hit
+ * @param hit index of the closest object so far, updated on a closer hit
+ * @return the number of intersection tests made
+ */
+long closestInWorldGrid(WorldGrid *grid, Scene *scene, real *Ro, real *Rd,
+                        real *max, int *hit) {
+  // clip the ray to the grid's box
+  double tNear = 0, tFar = INFINITY;
+  for (int a = 0; a < 3; a++) {
+    double lo = grid->lo[a];
+    double hi = lo + grid->cellSize[a] * grid->res[a];
+    if (Rd[a] == 0) {
+      if (Ro[a] < lo || Ro[a] > hi)
+        return 0;
+      continue;
+    }
+    double t0 = (lo - Ro[a]) / Rd[a];
+    double t1 = (hi - Ro[a]) / Rd[a];
+    tNear = fmax(tNear, fmin(t0, t1));
+    tFar = fmin(tFar, fmax(t0, t1));
+  }
+  if (tNear > tFar || tNear >= *max)
+    return 0;
+
+  int cell[3], step[3];
+  double tNext[3], tDelta[3];
+  for (int a = 0; a < 3; a++) {
+    double p = Ro[a] + tNear * Rd[a];
+    int c = (p - grid->lo[a]) / grid->cellSize[a];
+    cell[a] = c < 0 ? 0 : c >= grid->res[a] ? grid->res[a] - 1 : c;
+    if (Rd[a] > 0) {
+      step[a] = 1;
+      tNext[a] = (grid->lo[a] + (cell[a] + 1) * grid->cellSize[a] - Ro[a]) / Rd[a];
+      tDelta[a] = grid->cellSize[a] / Rd[a];
+    } else if (Rd[a] < 0) {
+      step[a] = -1;
+      tNext[a] = (grid->lo[a] + cell[a] * grid->cellSize[a] - Ro[a]) / Rd[a];
+      tDelta[a] = -grid->cellSize[a] / Rd[a];
+    } else {
+      step[a] = 0;
+      tNext[a] = INFINITY;
+      tDelta[a] = INFINITY;
+    }
+  }
+
+  long tests = 0;
+  while (1) {
+    int c = (cell[2] * grid->res[1] + cell[1]) * grid->res[0] + cell[0];
+    for (int k = grid->offsets[c]; k < grid->offsets[c + 1]; k++) {
+      int i = grid->indices[k];
+      real t = sphereIntersection(Ro, Rd, &scene->spheres[i]);
+      tests++;
+      if (t > 0 && t < *max) {
+        *max = t;
+        *hit = i;
+      }
+    }
+
+    // nothing in a later cell can be closer than what was found
+    int a = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+                                : (tNext[1] < tNext[2] ? 1 : 2);
+    if (*max <= tNext[a] || tNext[a] > tFar)
+      break;
+    cell[a] += step[a];
+    if (cell[a] < 0 || cell[a] >= grid->res[a])
+      break;
+    tNext[a] += tDelta[a];
+  }
+  return tests;
+}
+
+#endif